@@ -25,11 +25,51 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* TSC clock, calibrated against the PIT by timer_calibrate().
+   Nanoseconds since TSC_BASE are computed as
+   (cycles * tsc_mult) >> tsc_shift, with tsc_mult kept within 32
+   bits so the product can be formed from two 32x32-bit multiplies.
+   tsc_mult is 0 until calibration is done. */
+static uint64_t tsc_base;
+static uint32_t tsc_mult;
+static int tsc_shift;
+
+/* Task 1. Sleeping threads, hashed by absolute wakeup tick into
+   SLEEP_WHEEL_SIZE buckets.  Each bucket is kept sorted by wakeup
+   tick, so on every tick the interrupt handler only has to look
+   at the front of a single bucket and touches no thread that is
+   not due yet.  Sleeping threads are linked through their `elem',
+   which is free because a sleeping thread is on no other list. */
+#define SLEEP_WHEEL_SIZE 64
+static struct list sleep_wheel[SLEEP_WHEEL_SIZE];
+
+/* Tickless idle.  Before the idle thread halts, the PIT is
+   switched from periodic mode to a single countdown that ends at
+   the next sleeper's deadline, so an idle CPU is not woken on
+   every tick.  The 16-bit PIT counter limits one countdown to
+   TICKLESS_MAX_TICKS ticks.  The first interrupt of any kind
+   afterward returns the PIT to periodic mode and replays the ticks
+   that passed, see timer_idle_exit().  The part of a tick that
+   has passed when the PIT is reprogrammed is carried in
+   TICKLESS_CARRY, in PIT counts, so early wakes do not make
+   `ticks' fall behind. */
+#define PIT_TICK_COUNT ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+#define TICKLESS_MAX_TICKS (UINT16_MAX / PIT_TICK_COUNT)
+static bool tickless;           /* PIT is counting down once. */
+static int64_t tickless_ticks;  /* Ticks that countdown lasts. */
+static int64_t tickless_carry;  /* PIT counts short of a tick. */
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
+static int64_t wait_for_tick (uint64_t *tsc);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static bool wakeup_less (const struct list_elem *, const struct list_elem *,
+                         void *aux);
+static void timer_wakeup (int64_t now);
+static int64_t timer_next_wakeup (void);
+static void timer_tick (void);
 
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
@@ -37,19 +77,39 @@ static void real_time_delay (int64_t num, int32_t denom);
 void
 timer_init (void) 
 {
+  int i;
+
+  for (i = 0; i < SLEEP_WHEEL_SIZE; i++)
+    list_init (&sleep_wheel[i]);
+
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
-/* Calibrates loops_per_tick, used to implement brief delays. */
+/* Reads the CPU's time-stamp counter.  See [IA32-v2b] "RDTSC". */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Calibrates loops_per_tick, used to implement brief delays, and
+   the TSC rate, used by timer_now_ns().  The TSC is timed across
+   the whole loops_per_tick calibration, which spans many ticks. */
 void
 timer_calibrate (void) 
 {
   unsigned high_bit, test_bit;
+  uint64_t tsc_start, tsc_end, tsc_hz;
+  int64_t tick_start, tick_end;
 
   ASSERT (intr_get_level () == INTR_ON);
   printf ("Calibrating timer...  ");
 
+  tick_start = wait_for_tick (&tsc_start);
+
   /* Approximate loops_per_tick as the largest power-of-two
      still less than one timer tick. */
   loops_per_tick = 1u << 10;
@@ -65,7 +125,19 @@ timer_calibrate (void)
     if (!too_many_loops (high_bit | test_bit))
       loops_per_tick |= test_bit;
 
-  printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+  /* Derive tsc_mult and tsc_shift from the TSC rate, using the
+     largest shift that still keeps tsc_mult within 32 bits. */
+  tick_end = wait_for_tick (&tsc_end);
+  tsc_hz = (tsc_end - tsc_start) * TIMER_FREQ / (tick_end - tick_start);
+  for (tsc_shift = 32; tsc_shift > 0; tsc_shift--)
+    if (((uint64_t) NSEC_PER_SEC << tsc_shift) / tsc_hz <= UINT32_MAX)
+      break;
+  tsc_base = tsc_start - (tsc_end - tsc_start) * tick_start
+                          / (tick_end - tick_start);
+  tsc_mult = ((uint64_t) NSEC_PER_SEC << tsc_shift) / tsc_hz;
+
+  printf ("%'"PRIu64" loops/s, %'"PRIu64" TSC cycles/s.\n",
+          (uint64_t) loops_per_tick * TIMER_FREQ, tsc_hz);
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -78,6 +150,23 @@ timer_ticks (void)
   return t;
 }
 
+/* Returns the number of nanoseconds since the OS booted,
+   read from the TSC.  Before timer_calibrate() has run, falls back
+   to timer tick resolution.  Safe to call with interrupts off and
+   from interrupt handlers. */
+uint64_t
+timer_now_ns (void)
+{
+  uint64_t cycles;
+
+  if (tsc_mult == 0)
+    return (uint64_t) timer_ticks () * (NSEC_PER_SEC / TIMER_FREQ);
+
+  cycles = rdtsc () - tsc_base;
+  return ((uint64_t) (uint32_t) (cycles >> 32) * tsc_mult << (32 - tsc_shift))
+         + ((uint64_t) (uint32_t) cycles * tsc_mult >> tsc_shift);
+}
+
 /* Returns the number of timer ticks elapsed since THEN, which
    should be a value once returned by timer_ticks(). */
 int64_t
@@ -97,12 +186,15 @@ timer_sleep (int64_t ticks)
 
   // current thread must be awake.
   struct thread *cur = thread_current();
-  ASSERT (cur->snap_ticks == 0); 
-  cur->snap_ticks = ticks; 
+  ASSERT (cur->wakeup_tick == 0); 
 
   // thread_block requires turning off interruption manually. 
-  // put current thread to sleep, it will not be scheduled again until unlocked. 
+  // park current thread in the wheel bucket of its wakeup tick,
+  // it will not be scheduled again until timer_wakeup() unblocks it. 
   enum intr_level old_level = intr_disable(); 
+  cur->wakeup_tick = timer_ticks () + ticks;
+  list_insert_ordered (&sleep_wheel[cur->wakeup_tick % SLEEP_WHEEL_SIZE],
+                       &cur->elem, wakeup_less, NULL);
   thread_block(); 
   intr_set_level(old_level); 
 }
@@ -177,32 +269,160 @@ timer_print_stats (void)
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
 }
 
+/* Called by the idle thread, with interrupts off, right before
+   it halts.  If no sleeper is due on the next tick, stops the
+   periodic timer interrupt and arms a one-shot countdown for the
+   next sleeper's deadline instead. */
+void
+timer_idle_enter (void)
+{
+  int64_t delta;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (tickless)
+    return;
+
+  delta = timer_next_wakeup () - ticks;
+  if (delta <= 1)
+    return;
+  if (delta > TICKLESS_MAX_TICKS)
+    delta = TICKLESS_MAX_TICKS;
+
+  tickless = true;
+  tickless_ticks = delta;
+  tickless_carry += PIT_TICK_COUNT - pit_read_count (0);
+  pit_one_shot (0, delta * PIT_TICK_COUNT);
+}
+
+/* Called on entry to every external interrupt handler.  If the
+   PIT was left counting down by timer_idle_enter(), puts it back
+   into periodic mode and catches `ticks' up by the number of
+   whole ticks that have elapsed, running the per-tick work for
+   each of them, so timer_ticks() stays monotonic and no sleeper is
+   missed.  If the countdown has already run out, its interrupt is
+   pending (or being handled) and accounts for the final tick. */
+void
+timer_idle_exit (void)
+{
+  uint16_t count;
+  int64_t counted, elapsed;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!tickless)
+    return;
+
+  count = pit_read_count (0);
+  if (count == 0 || count > tickless_ticks * PIT_TICK_COUNT)
+    counted = (tickless_ticks - 1) * PIT_TICK_COUNT;
+  else
+    counted = tickless_ticks * PIT_TICK_COUNT - count;
+  counted += tickless_carry;
+  elapsed = counted / PIT_TICK_COUNT;
+  tickless_carry = counted % PIT_TICK_COUNT;
+
+  tickless = false;
+  pit_configure_channel (0, 2, TIMER_FREQ);
+
+  while (elapsed-- > 0)
+    timer_tick ();
+}
+
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-	static int secs = 0;
+  timer_tick ();
+}
 
+/* Accounts for one timer tick. */
+static void
+timer_tick (void)
+{
   ticks++;
   thread_tick (); // record time slice.
-  thread_foreach (thread_sleep_check, NULL);
+  timer_wakeup (ticks);
 
 	/* Task 3. data update per second for advanced scheduler.
 	 * update for system-wide load_avg, and
-	 * thread-specific recent_cpu. */
+	 * thread-specific recent_cpu, in constant time per tick. */
 	if (thread_mlfqs) {
 		thread_recent_cpu_increment();
-		if (ticks % TIMER_FREQ == 0) {
+		/* Other threads' recent_cpu decays lazily, see thread.c. */
+		if (ticks % TIMER_FREQ == 0)
 			thread_load_avg_update();
-			thread_foreach(thread_recent_cpu_update, NULL);
-			thread_foreach(thread_priority_update, NULL);
-		}
-		else if (ticks % 4 == 0) {
+		if (ticks % 4 == 0)
 			thread_priority_update(thread_current(), NULL);
-		}
-		if (thread_current()->priority < thread_highest_ready_priority())
-			intr_yield_on_return();
+		thread_mlfqs_refresh();
 	}
+
+	/* Preempt for a woken sleeper or a re-prioritized thread. */
+	thread_preempt ();
+}
+
+/* Task 1. Orders sleeping threads by ascending wakeup tick.
+   Threads due on the same tick stay in FIFO order. */
+static bool
+wakeup_less (const struct list_elem *a, const struct list_elem *b,
+             void *aux UNUSED)
+{
+  return list_entry (a, struct thread, elem)->wakeup_tick
+         < list_entry (b, struct thread, elem)->wakeup_tick;
+}
+
+/* Task 1. Unblocks every sleeping thread whose wakeup tick is NOW.
+   Only the bucket for NOW is examined, and only up to its first
+   thread that is not yet due. */
+static void
+timer_wakeup (int64_t now)
+{
+  struct list *bucket = &sleep_wheel[now % SLEEP_WHEEL_SIZE];
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (!list_empty (bucket))
+    {
+      struct thread *t = list_entry (list_front (bucket), struct thread, elem);
+      if (t->wakeup_tick > now)
+        break;
+
+      list_pop_front (bucket);
+      t->wakeup_tick = 0;
+      thread_unblock (t);
+    }
+}
+
+/* Returns the earliest wakeup tick of any sleeping thread, or
+   INT64_MAX if no thread is sleeping.  The front of each wheel
+   bucket is its earliest sleeper. */
+static int64_t
+timer_next_wakeup (void)
+{
+  int64_t next = INT64_MAX;
+  int i;
+
+  for (i = 0; i < SLEEP_WHEEL_SIZE; i++)
+    if (!list_empty (&sleep_wheel[i]))
+      {
+        struct thread *t = list_entry (list_front (&sleep_wheel[i]),
+                                       struct thread, elem);
+        if (t->wakeup_tick < next)
+          next = t->wakeup_tick;
+      }
+  return next;
+}
+
+/* Waits for the start of a timer tick and returns it, storing the
+   TSC at that moment into *TSC. */
+static int64_t
+wait_for_tick (uint64_t *tsc)
+{
+  int64_t start = ticks;
+  while (ticks == start)
+    barrier ();
+  *tsc = rdtsc ();
+  return start + 1;
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -266,14 +486,22 @@ real_time_sleep (int64_t num, int32_t denom)
     }
 }
 
-/* Busy-wait for approximately NUM/DENOM seconds. */
+/* Busy-wait for approximately NUM/DENOM seconds.  Spins on the
+   TSC clock once it is calibrated, otherwise on a loop count. */
 static void
 real_time_delay (int64_t num, int32_t denom)
 {
   /* Scale the numerator and denominator down by 1000 to avoid
      the possibility of overflow. */
   ASSERT (denom % 1000 == 0);
-  busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000)); 
+  if (tsc_mult != 0)
+    {
+      uint64_t end = timer_now_ns () + num * (NSEC_PER_SEC / denom);
+      while (num > 0 && timer_now_ns () < end)
+        barrier ();
+    }
+  else
+    busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000)); 
 }
 
 
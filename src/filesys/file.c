@@ -2,6 +2,7 @@
 #include <debug.h>
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "filesys/filesys.h"
 
 /* An open file. */
@@ -12,13 +13,23 @@ struct file
     bool deny_write;            /* Has file_deny_write() been called? */
   };
 
+/* Cache of struct file. */
+static struct kmem_cache *file_cache;
+
+/* Initializes the file module. */
+void
+file_init (void)
+{
+  file_cache = kmem_cache_create ("file", sizeof (struct file), NULL);
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) 
 {
-  struct file *file = calloc (1, sizeof *file);
+  struct file *file = kmem_cache_alloc (file_cache);
   if (inode != NULL && file != NULL)
     {
       file->inode = inode;
@@ -29,7 +40,7 @@ file_open (struct inode *inode)
   else
     {
       inode_close (inode);
-      free (file);
+      kmem_cache_free (file_cache, file);
       return NULL; 
     }
 }
@@ -50,7 +61,7 @@ file_close (struct file *file)
     {
       file_allow_write (file);
       inode_close (file->inode);
-      free (file); 
+      kmem_cache_free (file_cache, file);
     }
 }
 
@@ -189,7 +200,7 @@ fs_close (struct file *file)
 off_t
 fs_read (struct file *file, void *buffer, off_t size)
 {
-  acquire_fs_lock();
+  acquire_fs_lock_shared();
   off_t read_bytes = file_read(file, buffer, size);
   release_fs_lock();
   return read_bytes;
@@ -198,7 +209,7 @@ fs_read (struct file *file, void *buffer, off_t size)
 off_t
 fs_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 {
-  acquire_fs_lock();
+  acquire_fs_lock_shared();
   off_t read_bytes = file_read_at(file, buffer, size, file_ofs);
   release_fs_lock();
 
@@ -245,7 +256,7 @@ fs_seek (struct file *file, off_t new_pos)
 off_t
 fs_tell (struct file *file)
 {
-  acquire_fs_lock();
+  acquire_fs_lock_shared();
   off_t pos = file_tell(file);
   release_fs_lock();
 
@@ -255,7 +266,7 @@ fs_tell (struct file *file)
 off_t
 fs_length (struct file *file)
 {
-  acquire_fs_lock();
+  acquire_fs_lock_shared();
   off_t length = file_length(file);
   release_fs_lock();
 
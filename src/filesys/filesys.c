@@ -16,25 +16,31 @@ struct block *fs_device;
 void
 init_fs_lock()
 {
-  lock_init(&fs_lock);
+  rwlock_init(&fs_lock);
 }
 
 void
 acquire_fs_lock()
 {
-  lock_acquire(&fs_lock);
+  rwlock_acquire_exclusive(&fs_lock);
+}
+
+void
+acquire_fs_lock_shared()
+{
+  rwlock_acquire_shared(&fs_lock);
 }
 
 void
 release_fs_lock()
 {
-  lock_release(&fs_lock);
+  rwlock_release(&fs_lock);
 }
 
 bool
 is_holding_fs_lock()
 {
-  return lock_held_by_current_thread(&fs_lock);
+  return rwlock_held_by_current_thread(&fs_lock);
 }
 
 
@@ -50,6 +56,8 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  dir_init ();
+  file_init ();
   free_map_init ();
 
   if (format) 
@@ -12,10 +12,13 @@
 /* Block device that contains the file system. */
 struct block *fs_device;
 
-struct lock fs_lock;
+/* Readers share it for file reads; everything else takes it
+   exclusively. */
+struct rwlock fs_lock;
 
 void init_fs_lock();
 void acquire_fs_lock();
+void acquire_fs_lock_shared();
 void release_fs_lock();
 bool is_holding_fs_lock();
 
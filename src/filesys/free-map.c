@@ -27,7 +27,17 @@ free_map_init (void)
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  return free_map_allocate_near (0, cnt, sectorp);
+}
+
+/* Like free_map_allocate(), but prefers sectors at or after
+   NEAR, so that related sectors end up close together on disk. */
+bool
+free_map_allocate_near (block_sector_t near, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  block_sector_t sector = bitmap_scan_and_flip_near (free_map, near, cnt,
+                                                     false);
   if (sector != BITMAP_ERROR
       && free_map_file != NULL
       && !bitmap_write (free_map, free_map_file))
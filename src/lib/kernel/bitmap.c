@@ -21,13 +21,28 @@ typedef unsigned long elem_type;
 /* Number of bits in an element. */
 #define ELEM_BITS (sizeof (elem_type) * CHAR_BIT)
 
+/* Bitmaps created by bitmap_create() with at least this many
+   bits get a summary layer. */
+#define SUMMARY_MIN_BITS (ELEM_BITS * ELEM_BITS)
+
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   To keep scans from crawling over the parts of a bitmap that
+   are already allocated, FIRST[V] records a bit index below
+   which no bit is set to V, and a large bitmap also keeps a
+   summary with one bit per element: bit I of SUMMARY[V] is set
+   exactly if element I contains a bit set to V.  These are kept
+   up to date by every function that modifies the bitmap, so
+   callers must serialize modifications, as they already must
+   for bitmap_scan_and_flip(). */
 struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    size_t first[2];    /* No bit before FIRST[V] is set to V. */
+    elem_type *summary[2]; /* Summaries, or null pointers. */
   };
 
 /* Returns the index of the element that contains the bit
@@ -68,6 +83,135 @@ last_mask (const struct bitmap *b)
   int last_bits = b->bit_cnt % ELEM_BITS;
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Sets bit IDX in SUMMARY to VALUE. */
+static inline void
+summary_set (elem_type *summary, size_t idx, bool value)
+{
+  if (value)
+    summary[elem_idx (idx)] |= bit_mask (idx);
+  else
+    summary[elem_idx (idx)] &= ~bit_mask (idx);
+}
+
+/* Updates B's summaries for a change to element IDX. */
+static void
+sync_elem (struct bitmap *b, size_t idx)
+{
+  elem_type valid, bits;
+
+  if (b->summary[0] == NULL)
+    return;
+
+  valid = idx == elem_cnt (b->bit_cnt) - 1 ? last_mask (b) : (elem_type) -1;
+  bits = b->bits[idx] & valid;
+  summary_set (b->summary[true], idx, bits != 0);
+  summary_set (b->summary[false], idx, bits != valid);
+}
+
+/* Updates B's FIRST indexes for bits START up to END, exclusive,
+   having been set to VALUE. */
+static void
+sync_first (struct bitmap *b, size_t start, size_t end, bool value)
+{
+  if (start < b->first[value])
+    b->first[value] = start;
+  if (start <= b->first[!value] && end > b->first[!value])
+    b->first[!value] = end;
+}
+
+/* Returns a mask for the bits from BIT_IDX up to END, exclusive,
+   that lie in the element containing BIT_IDX, and stores the
+   number of those bits in *CNT. */
+static inline elem_type
+chunk_mask (size_t bit_idx, size_t end, size_t *cnt)
+{
+  size_t ofs = bit_idx % ELEM_BITS;
+  size_t n = ELEM_BITS - ofs;
+
+  if (n > end - bit_idx)
+    n = end - bit_idx;
+  *cnt = n;
+  return (n == ELEM_BITS ? (elem_type) -1 : ((elem_type) 1 << n) - 1) << ofs;
+}
+
+/* Returns element IDX of B, inverted if VALUE is false, so that
+   bits set to VALUE read as 1. */
+static inline elem_type
+elem_get (const struct bitmap *b, size_t idx, bool value)
+{
+  return value ? b->bits[idx] : ~b->bits[idx];
+}
+
+/* Returns the number of 1-bits in X. */
+static inline size_t
+elem_popcount (elem_type x)
+{
+  x = x - ((x >> 1) & (elem_type) 0x5555555555555555ULL);
+  x = (x & (elem_type) 0x3333333333333333ULL)
+      + ((x >> 2) & (elem_type) 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & (elem_type) 0x0f0f0f0f0f0f0f0fULL;
+  return (x * (elem_type) 0x0101010101010101ULL) >> (ELEM_BITS - CHAR_BIT);
+}
+
+/* Returns the index of the first element of B at or after IDX
+   that may contain a bit set to VALUE, or the number of elements
+   in B if there is none. */
+static size_t
+next_elem (const struct bitmap *b, size_t idx, bool value)
+{
+  size_t cnt = elem_cnt (b->bit_cnt);
+  const elem_type *summary = b->summary[value];
+  size_t summary_idx;
+  elem_type bits;
+
+  if (summary == NULL)
+    {
+      while (idx < cnt && elem_get (b, idx, value) == 0)
+        idx++;
+      return idx;
+    }
+
+  /* Skip whole groups of elements with one summary element. */
+  if (idx >= cnt)
+    return cnt;
+  summary_idx = elem_idx (idx);
+  bits = summary[summary_idx] & ~(bit_mask (idx) - 1);
+  while (bits == 0)
+    {
+      if (++summary_idx >= elem_cnt (cnt))
+        return cnt;
+      bits = summary[summary_idx];
+    }
+  idx = summary_idx * ELEM_BITS + __builtin_ctzl (bits);
+  return idx < cnt ? idx : cnt;
+}
+
+/* Returns the index of the first bit in B at or after START that
+   is set to VALUE, or the size of B if there is none. */
+static size_t
+next_bit (const struct bitmap *b, size_t start, bool value)
+{
+  size_t idx, bit_idx;
+  elem_type bits;
+
+  if (start >= b->bit_cnt)
+    return b->bit_cnt;
+
+  idx = elem_idx (start);
+  bits = elem_get (b, idx, value) & ~(bit_mask (start) - 1);
+  if (bits == 0)
+    {
+      idx = next_elem (b, idx + 1, value);
+      if (idx >= elem_cnt (b->bit_cnt))
+        return b->bit_cnt;
+      bits = elem_get (b, idx, value);
+    }
+
+  /* __builtin_ctzl() compiles to a single BSF instruction. */
+  bit_idx = idx * ELEM_BITS + __builtin_ctzl (bits);
+  return bit_idx < b->bit_cnt ? bit_idx : b->bit_cnt;
+}
 
 /* Creation and destruction. */
 
@@ -83,8 +227,20 @@ bitmap_create (size_t bit_cnt)
     {
       b->bit_cnt = bit_cnt;
       b->bits = malloc (byte_cnt (bit_cnt));
+      b->first[false] = b->first[true] = 0;
+      b->summary[false] = b->summary[true] = NULL;
       if (b->bits != NULL || bit_cnt == 0)
         {
+          /* The summary is only an optimization, so do without
+             it if there is no memory for it. */
+          if (bit_cnt >= SUMMARY_MIN_BITS)
+            {
+              size_t summary_cnt = elem_cnt (elem_cnt (bit_cnt));
+              b->summary[false] = calloc (2 * summary_cnt,
+                                          sizeof (elem_type));
+              if (b->summary[false] != NULL)
+                b->summary[true] = b->summary[false] + summary_cnt;
+            }
           bitmap_set_all (b, false);
           return b;
         }
@@ -105,6 +261,8 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 
   b->bit_cnt = bit_cnt;
   b->bits = (elem_type *) (b + 1);
+  b->first[false] = b->first[true] = 0;
+  b->summary[false] = b->summary[true] = NULL;
   bitmap_set_all (b, false);
   return b;
 }
@@ -124,6 +282,7 @@ bitmap_destroy (struct bitmap *b)
 {
   if (b != NULL) 
     {
+      free (b->summary[false]);
       free (b->bits);
       free (b);
     }
@@ -163,6 +322,8 @@ bitmap_mark (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the OR instruction in [IA32-v2b]. */
   asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  sync_elem (b, idx);
+  sync_first (b, bit_idx, bit_idx + 1, true);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -176,6 +337,8 @@ bitmap_reset (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the AND instruction in [IA32-v2a]. */
   asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  sync_elem (b, idx);
+  sync_first (b, bit_idx, bit_idx + 1, false);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -191,6 +354,8 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the XOR instruction in [IA32-v2b]. */
   asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  sync_elem (b, idx);
+  sync_first (b, bit_idx, bit_idx + 1, (b->bits[idx] & mask) != 0);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -213,18 +378,32 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element is updated atomically, but the bits as a whole
+   are not. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  size_t i, end, n;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  end = start + cnt;
+  for (i = start; i < end; i += n)
+    {
+      elem_type mask = chunk_mask (i, end, &n);
+      elem_type *bits = &b->bits[elem_idx (i)];
+
+      /* See bitmap_mark() and bitmap_reset(). */
+      if (value)
+        asm ("orl %1, %0" : "=m" (*bits) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "=m" (*bits) : "r" (~mask) : "cc");
+      sync_elem (b, elem_idx (i));
+    }
+  sync_first (b, start, end, value);
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,16 +411,19 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t i, end, n, value_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
+  end = start + cnt;
+  for (i = start; i < end; i += n)
+    {
+      elem_type mask = chunk_mask (i, end, &n);
+      value_cnt += elem_popcount (elem_get (b, elem_idx (i), value) & mask);
+    }
   return value_cnt;
 }
 
@@ -250,15 +432,19 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  size_t i, end, n;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
+  end = start + cnt;
+  for (i = start; i < end; i += n)
+    {
+      elem_type mask = chunk_mask (i, end, &n);
+      if ((elem_get (b, elem_idx (i), value) & mask) != 0)
+        return true;
+    }
   return false;
 }
 
@@ -290,25 +476,51 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
-   VALUE.
+   VALUE, where CNT must be nonzero, and stores into *SEEN the
+   index of the first bit set to VALUE that it passed over.
    If there is no such group, returns BITMAP_ERROR. */
-size_t
-bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+static size_t
+scan (const struct bitmap *b, size_t start, size_t cnt, bool value,
+      size_t *seen)
 {
-  ASSERT (b != NULL);
-  ASSERT (start <= b->bit_cnt);
+  size_t i = next_bit (b, start > b->first[value] ? start : b->first[value],
+                      value);
 
+  *seen = i;
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+
+      /* Find the end of each run of VALUE bits, then skip to the
+         start of the next one. */
+      while (i <= last)
+        {
+          size_t end = next_bit (b, i, !value);
+          if (end - i >= cnt)
+            return i;
+          i = next_bit (b, end, value);
+        }
     }
   return BITMAP_ERROR;
 }
 
+/* Finds and returns the starting index of the first group of CNT
+   consecutive bits in B at or after START that are all set to
+   VALUE.
+   If there is no such group, returns BITMAP_ERROR. */
+size_t
+bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  size_t seen;
+
+  ASSERT (b != NULL);
+  ASSERT (start <= b->bit_cnt);
+
+  if (cnt == 0)
+    return start;
+  return scan (b, start, cnt, value, &seen);
+}
+
 /* Finds the first group of CNT consecutive bits in B at or after
    START that are all set to VALUE, flips them all to !VALUE,
    and returns the index of the first bit in the group.
@@ -319,12 +531,42 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
 {
-  size_t idx = bitmap_scan (b, start, cnt, value);
+  size_t idx, seen;
+
+  ASSERT (b != NULL);
+  ASSERT (start <= b->bit_cnt);
+
+  if (cnt == 0)
+    return start;
+
+  /* The scan passed over only !VALUE bits before SEEN, so the
+     next scan for VALUE can start there. */
+  idx = scan (b, start, cnt, value, &seen);
+  if (start <= b->first[value])
+    b->first[value] = seen;
   if (idx != BITMAP_ERROR) 
     bitmap_set_multiple (b, idx, cnt, !value);
   return idx;
 }
-
+
+/* Like bitmap_scan_and_flip(), but prefers a group at or after
+   NEAR, such as the bit after one the caller allocated earlier,
+   and falls back to the first group in B if there is none. */
+size_t
+bitmap_scan_and_flip_near (struct bitmap *b, size_t near, size_t cnt,
+                           bool value)
+{
+  size_t idx = BITMAP_ERROR;
+
+  ASSERT (b != NULL);
+
+  if (near < b->bit_cnt)
+    idx = bitmap_scan_and_flip (b, near, cnt, value);
+  if (idx == BITMAP_ERROR)
+    idx = bitmap_scan_and_flip (b, 0, cnt, value);
+  return idx;
+}
+
 /* File input and output. */
 
 #ifdef FILESYS
@@ -344,8 +586,13 @@ bitmap_read (struct bitmap *b, struct file *file)
   if (b->bit_cnt > 0) 
     {
       off_t size = byte_cnt (b->bit_cnt);
+      size_t i;
+
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      b->first[false] = b->first[true] = 0;
+      for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+        sync_elem (b, i);
     }
   return success;
 }
@@ -3,6 +3,7 @@
 #include <random.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* Converts a string representation of a signed decimal integer
    in S into an `int', which is returned. */
@@ -40,63 +41,116 @@ atoi (const char *s)
   return value;
 }
 
-/* Compares A and B by calling the AUX function. */
-static int
-compare_thunk (const void *a, const void *b, void *aux) 
-{
-  int (**compare) (const void *, const void *) = aux;
-  return (*compare) (a, b);
-}
+/* Partitions with this many elements or fewer are finished
+   with an insertion sort. */
+#define INSERTION_MAX 16
+
+/* A comparison function, in one of the two forms that qsort()
+   and sort() accept.  Calling PLAIN directly, instead of through
+   a function that adapts it to the form of AUX_COMPARE, saves a
+   call per comparison. */
+struct comparator
+  {
+    int (*plain) (const void *, const void *);
+    int (*aux_compare) (const void *, const void *, void *aux);
+    void *aux;
+  };
+
+static void introsort (unsigned char *array, size_t cnt, size_t size,
+                       const struct comparator *, int depth);
 
 /* Sorts ARRAY, which contains CNT elements of SIZE bytes each,
    using COMPARE.  When COMPARE is passed a pair of elements A
    and B, respectively, it must return a strcmp()-type result,
    i.e. less than zero if A < B, zero if A == B, greater than
-   zero if A > B.  Runs in O(n lg n) time and O(1) space in
+   zero if A > B.  Runs in O(n lg n) time and O(lg n) space in
    CNT. */
 void
 qsort (void *array, size_t cnt, size_t size,
        int (*compare) (const void *, const void *)) 
 {
-  sort (array, cnt, size, compare_thunk, &compare);
+  struct comparator c = {compare, NULL, NULL};
+
+  ASSERT (array != NULL || cnt == 0);
+  ASSERT (compare != NULL);
+  ASSERT (size > 0);
+
+  introsort (array, cnt, size, &c, 0);
 }
 
-/* Swaps elements with 1-based indexes A_IDX and B_IDX in ARRAY
-   with elements of SIZE bytes each. */
-static void
-do_swap (unsigned char *array, size_t a_idx, size_t b_idx, size_t size)
+/* Sorts ARRAY, which contains CNT elements of SIZE bytes each,
+   using COMPARE to compare elements, passing AUX as auxiliary
+   data.  When COMPARE is passed a pair of elements A and B,
+   respectively, it must return a strcmp()-type result, i.e. less
+   than zero if A < B, zero if A == B, greater than zero if A >
+   B.  Runs in O(n lg n) time and O(lg n) space in CNT. */
+void
+sort (void *array, size_t cnt, size_t size,
+      int (*compare) (const void *, const void *, void *aux),
+      void *aux) 
 {
-  unsigned char *a = array + (a_idx - 1) * size;
-  unsigned char *b = array + (b_idx - 1) * size;
-  size_t i;
+  struct comparator c = {NULL, compare, aux};
 
-  for (i = 0; i < size; i++)
-    {
-      unsigned char t = a[i];
-      a[i] = b[i];
-      b[i] = t;
-    }
+  ASSERT (array != NULL || cnt == 0);
+  ASSERT (compare != NULL);
+  ASSERT (size > 0);
+
+  introsort (array, cnt, size, &c, 0);
 }
 
-/* Compares elements with 1-based indexes A_IDX and B_IDX in
-   ARRAY with elements of SIZE bytes each, using COMPARE to
-   compare elements, passing AUX as auxiliary data, and returns a
-   strcmp()-type result. */
-static int
-do_compare (unsigned char *array, size_t a_idx, size_t b_idx, size_t size,
-            int (*compare) (const void *, const void *, void *aux),
-            void *aux) 
+/* Returns a pointer to the element with 0-based index IDX in
+   ARRAY with elements of SIZE bytes each. */
+static inline unsigned char *
+elem (unsigned char *array, size_t idx, size_t size)
 {
-  return compare (array + (a_idx - 1) * size, array + (b_idx - 1) * size, aux);
+  return array + idx * size;
+}
+
+/* Compares elements A and B with C and returns a strcmp()-type
+   result. */
+static inline int
+do_compare (const struct comparator *c, const void *a, const void *b)
+{
+  return c->plain != NULL ? c->plain (a, b) : c->aux_compare (a, b, c->aux);
+}
+
+/* Swaps the SIZE-byte elements at A and B, a word at a time if
+   their size and alignment allow it. */
+static inline void
+do_swap (unsigned char *a, unsigned char *b, size_t size)
+{
+  if (size % sizeof (uint32_t) == 0
+      && ((uintptr_t) a | (uintptr_t) b) % sizeof (uint32_t) == 0)
+    {
+      uint32_t *wa = (uint32_t *) a;
+      uint32_t *wb = (uint32_t *) b;
+      size_t i;
+
+      for (i = 0; i < size / sizeof (uint32_t); i++)
+        {
+          uint32_t t = wa[i];
+          wa[i] = wb[i];
+          wb[i] = t;
+        }
+    }
+  else
+    {
+      size_t i;
+
+      for (i = 0; i < size; i++)
+        {
+          unsigned char t = a[i];
+          a[i] = b[i];
+          b[i] = t;
+        }
+    }
 }
 
 /* "Float down" the element with 1-based index I in ARRAY of CNT
-   elements of SIZE bytes each, using COMPARE to compare
-   elements, passing AUX as auxiliary data. */
+   elements of SIZE bytes each, using C to compare elements. */
 static void
 heapify (unsigned char *array, size_t i, size_t cnt, size_t size,
-         int (*compare) (const void *, const void *, void *aux),
-         void *aux) 
+         const struct comparator *c) 
 {
   for (;;) 
     {
@@ -105,10 +159,13 @@ heapify (unsigned char *array, size_t i, size_t cnt, size_t size,
       size_t left = 2 * i;
       size_t right = 2 * i + 1;
       size_t max = i;
-      if (left <= cnt && do_compare (array, left, max, size, compare, aux) > 0)
+      if (left <= cnt
+          && do_compare (c, elem (array, left - 1, size),
+                         elem (array, max - 1, size)) > 0)
         max = left;
       if (right <= cnt
-          && do_compare (array, right, max, size, compare, aux) > 0) 
+          && do_compare (c, elem (array, right - 1, size),
+                         elem (array, max - 1, size)) > 0) 
         max = right;
 
       /* If the maximum value is already in element I, we're
@@ -117,40 +174,139 @@ heapify (unsigned char *array, size_t i, size_t cnt, size_t size,
         break;
 
       /* Swap and continue down the heap. */
-      do_swap (array, i, max, size);
+      do_swap (elem (array, i - 1, size), elem (array, max - 1, size), size);
       i = max;
     }
 }
 
-/* Sorts ARRAY, which contains CNT elements of SIZE bytes each,
-   using COMPARE to compare elements, passing AUX as auxiliary
-   data.  When COMPARE is passed a pair of elements A and B,
-   respectively, it must return a strcmp()-type result, i.e. less
-   than zero if A < B, zero if A == B, greater than zero if A >
-   B.  Runs in O(n lg n) time and O(1) space in CNT. */
-void
-sort (void *array, size_t cnt, size_t size,
-      int (*compare) (const void *, const void *, void *aux),
-      void *aux) 
+/* Heapsorts ARRAY, which contains CNT elements of SIZE bytes
+   each, using C to compare elements. */
+static void
+heap_sort (unsigned char *array, size_t cnt, size_t size,
+           const struct comparator *c)
 {
   size_t i;
 
-  ASSERT (array != NULL || cnt == 0);
-  ASSERT (compare != NULL);
-  ASSERT (size > 0);
-
   /* Build a heap. */
   for (i = cnt / 2; i > 0; i--)
-    heapify (array, i, cnt, size, compare, aux);
+    heapify (array, i, cnt, size, c);
 
   /* Sort the heap. */
   for (i = cnt; i > 1; i--) 
     {
-      do_swap (array, 1, i, size);
-      heapify (array, 1, i - 1, size, compare, aux); 
+      do_swap (array, elem (array, i - 1, size), size);
+      heapify (array, 1, i - 1, size, c); 
     }
 }
 
+/* Insertion sorts ARRAY, which contains CNT elements of SIZE
+   bytes each, using C to compare elements. */
+static void
+insertion_sort (unsigned char *array, size_t cnt, size_t size,
+                const struct comparator *c)
+{
+  size_t i, j;
+
+  for (i = 1; i < cnt; i++)
+    for (j = i; j > 0; j--)
+      {
+        unsigned char *a = elem (array, j - 1, size);
+        unsigned char *b = elem (array, j, size);
+        if (do_compare (c, a, b) <= 0)
+          break;
+        do_swap (a, b, size);
+      }
+}
+
+/* Sorts ARRAY, which contains CNT elements of SIZE bytes each,
+   using C to compare elements.  Quicksorts with a median-of-three
+   pivot, but switches to heapsort after DEPTH levels of
+   partitioning, or after 2 lg CNT levels if DEPTH is 0, so that
+   inputs that defeat the pivot choice still take O(n lg n) time.
+   Always recurses on the smaller partition, so the stack depth
+   is O(lg n). */
+static void
+introsort (unsigned char *array, size_t cnt, size_t size,
+           const struct comparator *c, int depth)
+{
+  if (depth == 0)
+    {
+      size_t n;
+      for (n = cnt; n > 1; n /= 2)
+        depth += 2;
+      depth++;
+    }
+
+  while (cnt > INSERTION_MAX)
+    {
+      unsigned char *pivot = array;
+      unsigned char *mid = elem (array, cnt / 2, size);
+      unsigned char *last = elem (array, cnt - 1, size);
+      size_t i, j;
+
+      if (--depth == 0)
+        {
+          heap_sort (array, cnt, size, c);
+          return;
+        }
+
+      /* Order the first, middle and last elements, then move
+         their median to the front as the pivot.  That leaves an
+         element no less than the pivot at the end, which stops
+         the upward scan below. */
+      if (do_compare (c, mid, array) < 0)
+        do_swap (mid, array, size);
+      if (do_compare (c, last, mid) < 0)
+        {
+          do_swap (last, mid, size);
+          if (do_compare (c, mid, array) < 0)
+            do_swap (mid, array, size);
+        }
+      do_swap (array, mid, size);
+
+      /* Partition the rest around the pivot. */
+      i = 0;
+      j = cnt;
+      for (;;)
+        {
+          do
+            i++;
+          while (i < cnt && do_compare (c, elem (array, i, size), pivot) < 0);
+          do
+            j--;
+          while (do_compare (c, elem (array, j, size), pivot) > 0);
+          if (i >= j)
+            break;
+          do_swap (elem (array, i, size), elem (array, j, size), size);
+        }
+      do_swap (array, elem (array, j, size), size);
+
+      /* Elements 0...J-1 are no greater than the pivot, now at J,
+         and elements J+1...CNT-1 are no less.  Recurse on the
+         smaller side and loop on the larger. */
+      if (j < cnt - j - 1)
+        {
+          introsort (array, j, size, c, depth);
+          array = elem (array, j + 1, size);
+          cnt -= j + 1;
+        }
+      else
+        {
+          introsort (elem (array, j + 1, size), cnt - j - 1, size, c, depth);
+          cnt = j;
+        }
+    }
+  insertion_sort (array, cnt, size, c);
+}
+
+/* Compares A and B by calling the AUX function. */
+static int
+compare_thunk (const void *a, const void *b, void *aux) 
+{
+  int (**compare) (const void *, const void *) = aux;
+  return (*compare) (a, b);
+}
+
 /* Searches ARRAY, which contains CNT elements of SIZE bytes
    each, for the given KEY.  Returns a match is found, otherwise
    a null pointer.  If there are multiple matches, returns an
@@ -0,0 +1,260 @@
+/* Test program for lib/kernel/bitmap.c.
+
+   Checks the word-at-a-time bitmap operations against simple
+   bit-at-a-time versions of the same operations, checks that
+   allocation hints and summaries never hide free bits, then
+   times scans of a large bitmap.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+
+/* Maximum number of bits in a bitmap that we will check. */
+#define MAX_BITS 300
+
+/* Number of bits in a bitmap large enough to have a summary. */
+#define LARGE_BITS 20000
+
+/* Number of bits in the bitmap we time scans on. */
+#define BENCH_BITS (1024 * 1024)
+
+static void fill_random (struct bitmap *, size_t max_run);
+static size_t ref_scan (const struct bitmap *, size_t start, size_t cnt,
+                        bool value);
+static size_t ref_count (const struct bitmap *, size_t start, size_t cnt,
+                         bool value);
+static void verify_equal (const struct bitmap *, const struct bitmap *);
+static void check_hints (void);
+static void bench_scan (void);
+static void bench_next_fit (void);
+
+/* Test the bitmap implementation. */
+void
+test (void)
+{
+  size_t size;
+
+  printf ("testing various size bitmaps:");
+  for (size = 0; size <= MAX_BITS; size += 1 + size / 8)
+    {
+      struct bitmap *b = bitmap_create (size);
+      struct bitmap *c = bitmap_create (size);
+      int repeat;
+
+      ASSERT (b != NULL && c != NULL);
+      printf (" %zu", size);
+      for (repeat = 0; repeat < 20; repeat++)
+        {
+          size_t start = size ? random_ulong () % (size + 1) : 0;
+          size_t cnt = random_ulong () % (size - start + 1);
+          bool value = random_ulong () % 2;
+          size_t i;
+
+          /* Scan, count and contains. */
+          fill_random (b, 1 + repeat % 10);
+          ASSERT (bitmap_scan (b, start, cnt, value)
+                  == ref_scan (b, start, cnt, value));
+          ASSERT (bitmap_count (b, start, cnt, value)
+                  == ref_count (b, start, cnt, value));
+          ASSERT (bitmap_contains (b, start, cnt, value)
+                  == (ref_count (b, start, cnt, value) != 0));
+
+          /* Setting a range. */
+          for (i = 0; i < size; i++)
+            bitmap_set (c, i, bitmap_test (b, i));
+          bitmap_set_multiple (b, start, cnt, value);
+          for (i = 0; i < cnt; i++)
+            bitmap_set (c, start + i, value);
+          verify_equal (b, c);
+        }
+      bitmap_destroy (b);
+      bitmap_destroy (c);
+    }
+  printf (" done\n");
+
+  check_hints ();
+  bench_scan ();
+  bench_next_fit ();
+  printf ("bitmap: PASS\n");
+}
+
+/* Sets B to random runs of bits, each at most MAX_RUN long. */
+static void
+fill_random (struct bitmap *b, size_t max_run)
+{
+  size_t i = 0;
+
+  while (i < bitmap_size (b))
+    {
+      size_t run = 1 + random_ulong () % max_run;
+      bool value = random_ulong () % 2;
+
+      if (run > bitmap_size (b) - i)
+        run = bitmap_size (b) - i;
+      while (run-- > 0)
+        bitmap_set (b, i++, value);
+    }
+}
+
+/* bitmap_scan(), one bit at a time. */
+static size_t
+ref_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  if (cnt <= bitmap_size (b))
+    {
+      size_t last = bitmap_size (b) - cnt;
+      size_t i;
+      for (i = start; i <= last; i++)
+        if (ref_count (b, i, cnt, !value) == 0)
+          return i;
+    }
+  return BITMAP_ERROR;
+}
+
+/* bitmap_count(), one bit at a time. */
+static size_t
+ref_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i, value_cnt = 0;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      value_cnt++;
+  return value_cnt;
+}
+
+/* Verifies that bitmaps B and C have the same bits. */
+static void
+verify_equal (const struct bitmap *b, const struct bitmap *c)
+{
+  size_t i;
+
+  ASSERT (bitmap_size (b) == bitmap_size (c));
+  for (i = 0; i < bitmap_size (b); i++)
+    ASSERT (bitmap_test (b, i) == bitmap_test (c, i));
+}
+
+/* Allocates and frees random runs in a large bitmap, checking
+   scans against bit-at-a-time scans after every change. */
+static void
+check_hints (void)
+{
+  struct bitmap *b = bitmap_create (LARGE_BITS);
+  int repeat;
+
+  ASSERT (b != NULL);
+  printf ("testing allocation hints:");
+  for (repeat = 0; repeat < 2000; repeat++)
+    {
+      size_t start = random_ulong () % LARGE_BITS;
+      size_t cnt = 1 + random_ulong () % 64;
+      bool value = random_ulong () % 2;
+
+      switch (random_ulong () % 4)
+        {
+        case 0:
+          if (cnt > LARGE_BITS - start)
+            cnt = LARGE_BITS - start;
+          bitmap_set_multiple (b, start, cnt, value);
+          break;
+        case 1:
+          bitmap_flip (b, start);
+          break;
+        case 2:
+          {
+            size_t expected = ref_scan (b, start, cnt, value);
+            ASSERT (bitmap_scan_and_flip (b, start, cnt, value) == expected);
+          }
+          break;
+        case 3:
+          {
+            size_t expected = ref_scan (b, start, cnt, value);
+            if (expected == BITMAP_ERROR)
+              expected = ref_scan (b, 0, cnt, value);
+            ASSERT (bitmap_scan_and_flip_near (b, start, cnt, value)
+                    == expected);
+          }
+          break;
+        }
+
+      ASSERT (bitmap_scan (b, 0, cnt, value) == ref_scan (b, 0, cnt, value));
+      ASSERT (bitmap_scan (b, start, 1, !value)
+              == ref_scan (b, start, 1, !value));
+      if (repeat % 200 == 0)
+        printf (" %d", repeat);
+    }
+  printf (" done\n");
+  bitmap_destroy (b);
+}
+
+/* Times scans for a short run of free bits in a large bitmap
+   that is full except near its end, as palloc and the swap map
+   see when memory is short.  In the fragmented layout a single
+   free bit is left in every 32, so that neither the FIRST cursor
+   nor the summary can skip any of the map; in the full layout the
+   cursor leads straight to the run. */
+static void
+bench_scan (void)
+{
+  struct bitmap *b = bitmap_create (BENCH_BITS);
+  uint64_t start;
+  size_t idx;
+  size_t i;
+
+  ASSERT (b != NULL);
+  bitmap_set_all (b, true);
+  for (i = 0; i < BENCH_BITS - 100; i += 32)
+    bitmap_reset (b, i);
+  bitmap_set_multiple (b, BENCH_BITS - 100, 8, false);
+
+  start = timer_now_ns ();
+  idx = ref_scan (b, 0, 8, false);
+  printf ("bit-at-a-time scan of %d fragmented bits: %llu us\n",
+          BENCH_BITS, (timer_now_ns () - start) / 1000);
+  ASSERT (idx == BENCH_BITS - 100);
+
+  start = timer_now_ns ();
+  idx = bitmap_scan (b, 0, 8, false);
+  printf ("word-at-a-time scan of %d fragmented bits: %llu us\n",
+          BENCH_BITS, (timer_now_ns () - start) / 1000);
+  ASSERT (idx == BENCH_BITS - 100);
+
+  bitmap_set_all (b, true);
+  bitmap_set_multiple (b, BENCH_BITS - 100, 8, false);
+
+  start = timer_now_ns ();
+  idx = bitmap_scan (b, 0, 8, false);
+  printf ("cursor-assisted scan of %d full bits: %llu us\n",
+          BENCH_BITS, (timer_now_ns () - start) / 1000);
+  ASSERT (idx == BENCH_BITS - 100);
+
+  bitmap_destroy (b);
+}
+
+/* Times allocating every bit of a large bitmap one at a time from
+   the start, as the big-block window in malloc() does, which
+   takes quadratic time without the allocation cursor. */
+static void
+bench_next_fit (void)
+{
+  struct bitmap *b = bitmap_create (BENCH_BITS);
+  uint64_t start;
+  size_t i;
+
+  ASSERT (b != NULL);
+  start = timer_now_ns ();
+  for (i = 0; i < BENCH_BITS; i++)
+    ASSERT (bitmap_scan_and_flip (b, 0, 1, false) == i);
+  ASSERT (bitmap_scan_and_flip (b, 0, 1, false) == BITMAP_ERROR);
+  printf ("next-fit allocation of %d bits: %llu us\n",
+          BENCH_BITS, (timer_now_ns () - start) / 1000);
+  bitmap_destroy (b);
+}
@@ -0,0 +1,206 @@
+/* Freestanding runtime for the test programs in this directory.
+
+   Stands in for the parts of the kernel that the programs and
+   the library code under test use: the console, the heap, the
+   timer and PANIC.  Linked with lib/ into a static 32-bit
+   executable that talks to the host through Linux's int $0x80
+   system calls, so that the library code is built exactly as it
+   is in the kernel, with Pintos's own headers.  See Makefile. */
+
+#include <debug.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/test.h"
+
+/* Linux i386 system call numbers. */
+#define SYS_EXIT 1
+#define SYS_WRITE 4
+#define SYS_CLOCK_GETTIME 265
+#define CLOCK_MONOTONIC 1
+
+void _start (void) NO_RETURN;
+static void host_exit (int) NO_RETURN;
+static void flush (void);
+
+static int
+host_syscall (int number, int arg0, int arg1, int arg2)
+{
+  int retval;
+  asm volatile ("int $0x80"
+                : "=a" (retval)
+                : "a" (number), "b" (arg0), "c" (arg1), "d" (arg2)
+                : "memory");
+  return retval;
+}
+
+/* Runs the test program and exits. */
+void
+_start (void)
+{
+  test ();
+  host_exit (0);
+}
+
+static void
+host_exit (int status)
+{
+  flush ();
+  host_syscall (SYS_EXIT, status, 0, 0);
+  for (;;);
+}
+
+/* Console. */
+
+static char out_buf[4096];
+static size_t out_cnt;
+
+static void
+flush (void)
+{
+  if (out_cnt > 0)
+    host_syscall (SYS_WRITE, 1, (int) out_buf, out_cnt);
+  out_cnt = 0;
+}
+
+int
+putchar (int c)
+{
+  out_buf[out_cnt++] = c;
+  if (c == '\n' || out_cnt == sizeof out_buf)
+    flush ();
+  return c;
+}
+
+static void
+vprintf_helper (char c, void *aux UNUSED)
+{
+  putchar (c);
+}
+
+int
+vprintf (const char *format, va_list args)
+{
+  __vprintf (format, args, vprintf_helper, NULL);
+  return 0;
+}
+
+int
+puts (const char *s)
+{
+  while (*s != '\0')
+    putchar (*s++);
+  putchar ('\n');
+  return 0;
+}
+
+void
+debug_panic (const char *file, int line, const char *function,
+             const char *message, ...)
+{
+  va_list args;
+
+  printf ("PANIC at %s:%d in %s(): ", file, line, function);
+  va_start (args, message);
+  vprintf (message, args);
+  va_end (args);
+  printf ("\n");
+  host_exit (1);
+}
+
+/* Heap.  Blocks are carved from a static arena and never
+   reused, except that freeing the most recent block returns it,
+   which is enough for the short-lived programs here. */
+
+#define ARENA_SIZE (64 * 1024 * 1024)
+
+struct header
+  {
+    size_t size;
+    size_t pad;                 /* Keeps blocks 8-byte aligned. */
+  };
+
+static uint8_t arena[ARENA_SIZE] __attribute__ ((aligned (8)));
+static size_t arena_used;
+
+void *
+malloc (size_t size)
+{
+  struct header *h = (struct header *) (arena + arena_used);
+  size_t total = sizeof *h + ((size + 7) & ~7u);
+
+  if (total > ARENA_SIZE - arena_used)
+    return NULL;
+  arena_used += total;
+  h->size = size;
+  return h + 1;
+}
+
+void *
+calloc (size_t a, size_t b)
+{
+  void *p = malloc (a * b);
+  if (p != NULL)
+    memset (p, 0, a * b);
+  return p;
+}
+
+void *
+realloc (void *old, size_t size)
+{
+  void *p;
+
+  if (old == NULL)
+    return malloc (size);
+  p = malloc (size);
+  if (p != NULL)
+    {
+      size_t old_size = ((struct header *) old - 1)->size;
+      memcpy (p, old, old_size < size ? old_size : size);
+      free (old);
+    }
+  return p;
+}
+
+void
+free (void *p)
+{
+  if (p != NULL)
+    {
+      struct header *h = (struct header *) p - 1;
+      if ((uint8_t *) h + sizeof *h + ((h->size + 7) & ~7u)
+          == arena + arena_used)
+        arena_used = (uint8_t *) h - arena;
+    }
+}
+
+/* Timer. */
+
+uint64_t
+timer_now_ns (void)
+{
+  struct
+    {
+      int32_t sec;
+      int32_t nsec;
+    }
+  ts;
+
+  host_syscall (SYS_CLOCK_GETTIME, CLOCK_MONOTONIC, (int) &ts, 0);
+  return (uint64_t) ts.sec * NSEC_PER_SEC + ts.nsec;
+}
+
+int64_t
+timer_ticks (void)
+{
+  return timer_now_ns () / (NSEC_PER_SEC / TIMER_FREQ);
+}
+
+int64_t
+timer_elapsed (int64_t then)
+{
+  return timer_ticks () - then;
+}
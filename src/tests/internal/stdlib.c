@@ -1,7 +1,8 @@
 /* Test program for sorting and searching in lib/stdlib.c.
 
    Attempts to test the sorting and searching functionality that
-   is not sufficiently tested elsewhere in Pintos.
+   is not sufficiently tested elsewhere in Pintos, and times
+   sorting a large array.
 
    This is not a test we will run on your submitted projects.
    It is here for completeness.
@@ -13,15 +14,21 @@
 #include <random.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
 #include "threads/test.h"
 
 /* Maximum number of elements in an array that we will test. */
 #define MAX_CNT 4096
 
+/* Number of elements in the array that we time sorting. */
+#define BENCH_CNT (1024 * 1024)
+
 static void shuffle (int[], size_t);
 static int compare_ints (const void *, const void *);
 static void verify_order (const int[], size_t);
 static void verify_bsearch (const int[], size_t);
+static void bench_sort (void);
 
 /* Test sorting and searching implementations. */
 void
@@ -53,6 +60,7 @@ test (void)
     }
   
   printf (" done\n");
+  bench_sort ();
   printf ("stdlib: PASS\n");
 }
 
@@ -112,3 +120,40 @@ verify_bsearch (const int *array, size_t cnt)
     ASSERT (bsearch (&not_in_array[i], array, cnt, sizeof *array, compare_ints)
             == NULL);
 }
+
+/* Times sorting BENCH_CNT ints in random, ascending and
+   descending order. */
+static void
+bench_sort (void)
+{
+  int *values = malloc (BENCH_CNT * sizeof *values);
+  uint64_t start;
+  int i;
+
+  ASSERT (values != NULL);
+
+  for (i = 0; i < BENCH_CNT; i++)
+    values[i] = i;
+  shuffle (values, BENCH_CNT);
+  start = timer_now_ns ();
+  qsort (values, BENCH_CNT, sizeof *values, compare_ints);
+  printf ("sorting %d random ints: %llu us\n",
+          BENCH_CNT, (timer_now_ns () - start) / 1000);
+  verify_order (values, BENCH_CNT);
+
+  start = timer_now_ns ();
+  qsort (values, BENCH_CNT, sizeof *values, compare_ints);
+  printf ("sorting %d ascending ints: %llu us\n",
+          BENCH_CNT, (timer_now_ns () - start) / 1000);
+  verify_order (values, BENCH_CNT);
+
+  for (i = 0; i < BENCH_CNT; i++)
+    values[i] = BENCH_CNT - 1 - i;
+  start = timer_now_ns ();
+  qsort (values, BENCH_CNT, sizeof *values, compare_ints);
+  printf ("sorting %d descending ints: %llu us\n",
+          BENCH_CNT, (timer_now_ns () - start) / 1000);
+  verify_order (values, BENCH_CNT);
+
+  free (values);
+}
@@ -0,0 +1,182 @@
+/* Test program for the block functions in lib/string.c.
+
+   Checks memcpy(), memmove(), memset(), memcmp() and strlen()
+   against byte-at-a-time versions for all small sizes and
+   alignments, then measures the throughput of both versions on
+   blocks from 8 bytes to 64 kB.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/test.h"
+
+/* Largest block that we check exhaustively. */
+#define MAX_CHECK 80
+
+/* Largest block that we time. */
+#define MAX_BENCH (64 * 1024)
+
+/* Bytes to process for each timing. */
+#define BENCH_BYTES (64 * 1024 * 1024)
+
+static void check_sizes (void);
+static void bench (void);
+static uint64_t mb_per_sec (uint64_t ns);
+static void *ref_memcpy (void *, const void *, size_t);
+static void *ref_memset (void *, int, size_t);
+
+/* Test the block functions. */
+void
+test (void)
+{
+  check_sizes ();
+  bench ();
+  printf ("string: PASS\n");
+}
+
+/* Checks every size up to MAX_CHECK at every alignment of the
+   source and destination within a word. */
+static void
+check_sizes (void)
+{
+  static unsigned char a[MAX_CHECK + 16], b[MAX_CHECK + 16];
+  static unsigned char c[MAX_CHECK + 16];
+  size_t size, src_ofs, dst_ofs;
+
+  printf ("testing block functions:");
+  for (size = 0; size <= MAX_CHECK; size++)
+    {
+      if (size % 10 == 0)
+        printf (" %zu", size);
+      for (src_ofs = 0; src_ofs < 4; src_ofs++)
+        for (dst_ofs = 0; dst_ofs < 4; dst_ofs++)
+          {
+            size_t i;
+
+            /* memcpy(). */
+            random_bytes (a, sizeof a);
+            random_bytes (b, sizeof b);
+            memcpy (c, b, sizeof c);
+            ASSERT (memcpy (b + dst_ofs, a + src_ofs, size) == b + dst_ofs);
+            ref_memcpy (c + dst_ofs, a + src_ofs, size);
+            ASSERT (!memcmp (b, c, sizeof b));
+
+            /* memmove() in both directions within one block. */
+            random_bytes (b, sizeof b);
+            memcpy (c, b, sizeof c);
+            ASSERT (memmove (b + dst_ofs, b + src_ofs, size) == b + dst_ofs);
+            memcpy (a, c, sizeof a);
+            ref_memcpy (c + dst_ofs, a + src_ofs, size);
+            ASSERT (!memcmp (b, c, sizeof b));
+
+            /* memset(). */
+            memcpy (c, b, sizeof c);
+            ASSERT (memset (b + dst_ofs, 0x5a + size, size) == b + dst_ofs);
+            ref_memset (c + dst_ofs, 0x5a + size, size);
+            ASSERT (!memcmp (b, c, sizeof b));
+
+            /* memcmp() with a difference at each position. */
+            memcpy (a + src_ofs, b + dst_ofs, size);
+            ASSERT (memcmp (a + src_ofs, b + dst_ofs, size) == 0);
+            for (i = 0; i < size; i++)
+              {
+                a[src_ofs + i]++;
+                ASSERT (memcmp (a + src_ofs, b + dst_ofs, size)
+                        == (a[src_ofs + i] > b[dst_ofs + i] ? 1 : -1));
+                a[src_ofs + i]--;
+              }
+
+            /* strlen(). */
+            memset (a, 'x', sizeof a);
+            a[src_ofs + size] = '\0';
+            ASSERT (strlen ((char *) a + src_ofs) == size);
+          }
+    }
+  printf (" done\n");
+}
+
+/* Times copying and clearing blocks of each size with the byte
+   loops and with the library functions, and prints the
+   throughput of each in MB/s. */
+static void
+bench (void)
+{
+  unsigned char *a = malloc (MAX_BENCH);
+  unsigned char *b = malloc (MAX_BENCH);
+  size_t size;
+
+  ASSERT (a != NULL && b != NULL);
+  random_bytes (a, MAX_BENCH);
+  for (size = 8; size <= MAX_BENCH; size *= 2)
+    {
+      size_t cnt = BENCH_BYTES / size;
+      uint64_t ref_copy, copy, ref_set, set, start;
+      size_t i;
+
+      start = timer_now_ns ();
+      for (i = 0; i < cnt; i++)
+        ref_memcpy (b, a, size);
+      ref_copy = timer_now_ns () - start;
+
+      start = timer_now_ns ();
+      for (i = 0; i < cnt; i++)
+        memcpy (b, a, size);
+      copy = timer_now_ns () - start;
+
+      start = timer_now_ns ();
+      for (i = 0; i < cnt; i++)
+        ref_memset (b, i, size);
+      ref_set = timer_now_ns () - start;
+
+      start = timer_now_ns ();
+      for (i = 0; i < cnt; i++)
+        memset (b, i, size);
+      set = timer_now_ns () - start;
+
+      printf ("%5zu-byte blocks: memcpy %llu MB/s (bytewise %llu), "
+              "memset %llu MB/s (bytewise %llu)\n",
+              size, mb_per_sec (copy), mb_per_sec (ref_copy),
+              mb_per_sec (set), mb_per_sec (ref_set));
+    }
+  free (a);
+  free (b);
+}
+
+/* Returns the throughput of processing BENCH_BYTES in NS
+   nanoseconds, in MB/s. */
+static uint64_t
+mb_per_sec (uint64_t ns)
+{
+  return (uint64_t) BENCH_BYTES * 1000 / (ns > 0 ? ns : 1);
+}
+
+/* memcpy(), one byte at a time. */
+static void *
+ref_memcpy (void *dst_, const void *src_, size_t size)
+{
+  volatile unsigned char *dst = dst_;
+  const unsigned char *src = src_;
+
+  while (size-- > 0)
+    *dst++ = *src++;
+  return dst_;
+}
+
+/* memset(), one byte at a time. */
+static void *
+ref_memset (void *dst_, int value, size_t size)
+{
+  volatile unsigned char *dst = dst_;
+
+  while (size-- > 0)
+    *dst++ = value;
+  return dst_;
+}
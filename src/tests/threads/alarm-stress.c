@@ -0,0 +1,113 @@
+/* Parks 1000 threads in timer_sleep() and measures how much of
+   each timer tick the interrupt handler costs while they sleep,
+   by comparing how far a busy loop gets per tick with and without
+   the sleepers.  Then verifies that every sleeper woke up, and
+   that none of them woke up early. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Number of sleeping threads. */
+#define SLEEPER_CNT 1000
+
+/* Number of ticks to busy-loop for each measurement. */
+#define MEASURE_TICKS 20
+
+/* Information about the test. */
+struct stress_test
+  {
+    int64_t wakeup;             /* Tick all sleepers wait for. */
+    struct lock lock;           /* Protects the fields below. */
+    int woken;                  /* Number of sleepers woken. */
+    int early;                  /* Number of sleepers woken early. */
+    struct semaphore done;      /* Upped by the last sleeper. */
+  };
+
+static void sleeper (void *);
+static int64_t loops_per_tick (void);
+
+void
+test_alarm_stress (void)
+{
+  struct stress_test test;
+  int64_t idle_loops, busy_loops;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  lock_init (&test.lock);
+  sema_init (&test.done, 0);
+  test.woken = test.early = 0;
+
+  msg ("Measuring busy loops per tick with no sleepers.");
+  idle_loops = loops_per_tick ();
+
+  msg ("Creating %d threads to sleep until the same tick.", SLEEPER_CNT);
+  test.wakeup = timer_ticks () + 500;
+  for (i = 0; i < SLEEPER_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "sleeper %d", i);
+      if (thread_create (name, PRI_DEFAULT, sleeper, &test) == TID_ERROR)
+        fail ("thread_create() failed for sleeper %d", i);
+    }
+
+  msg ("Measuring busy loops per tick with %d sleepers.", SLEEPER_CNT);
+  busy_loops = loops_per_tick ();
+  if (timer_ticks () >= test.wakeup)
+    fail ("sleepers woke up before the measurement finished");
+
+  /* Per-tick handler cost, as the fraction of a tick lost to it,
+     in thousandths. */
+  printf ("(alarm-stress) %lld loops/tick idle, %lld loops/tick with "
+          "sleepers, handler overhead %lld/1000 of a tick\n",
+          idle_loops, busy_loops,
+          idle_loops > busy_loops
+          ? (idle_loops - busy_loops) * 1000 / idle_loops : 0);
+
+  sema_down (&test.done);
+  if (test.early != 0)
+    fail ("%d sleepers woke up early", test.early);
+  msg ("All %d sleepers woke up on time.", SLEEPER_CNT);
+  pass ();
+}
+
+/* Sleeper thread. */
+static void
+sleeper (void *test_)
+{
+  struct stress_test *test = test_;
+
+  timer_sleep (test->wakeup - timer_ticks ());
+
+  lock_acquire (&test->lock);
+  if (timer_ticks () < test->wakeup)
+    test->early++;
+  if (++test->woken == SLEEPER_CNT)
+    sema_up (&test->done);
+  lock_release (&test->lock);
+}
+
+/* Returns the average number of busy loop iterations the current
+   thread completes per timer tick over MEASURE_TICKS ticks. */
+static int64_t
+loops_per_tick (void)
+{
+  int64_t start, loops = 0;
+
+  /* Start at the beginning of a timer tick. */
+  start = timer_ticks ();
+  while (timer_ticks () == start)
+    continue;
+
+  start = timer_ticks ();
+  while (timer_elapsed (start) < MEASURE_TICKS)
+    loops++;
+  return loops / MEASURE_TICKS;
+}
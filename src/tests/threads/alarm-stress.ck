@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# The loop counts depend on the simulator, so just require that
+# they were reported.
+fail "Per-tick handler cost was not reported.\n"
+  if !grep (/^\(alarm-stress\) \d+ loops\/tick idle, \d+ loops\/tick with sleepers, handler overhead \d+\/1000 of a tick$/, @output);
+@output = grep (!/loops\/tick/, @output);
+
+compare_output ("run", \@output, [<<'EOF']);
+(alarm-stress) begin
+(alarm-stress) Measuring busy loops per tick with no sleepers.
+(alarm-stress) Creating 1000 threads to sleep until the same tick.
+(alarm-stress) Measuring busy loops per tick with 1000 sleepers.
+(alarm-stress) All 1000 sleepers woke up on time.
+(alarm-stress) PASS
+(alarm-stress) end
+EOF
+pass;
@@ -0,0 +1,64 @@
+/* The main thread acquires a reader-writer lock for reading.  A
+   higher-priority reader shares it right away.  Then a writer
+   blocks on it, donating its priority to the main thread, and a
+   still higher-priority reader queues up behind the writer,
+   donating through the writer to the main thread.  When the main
+   thread releases the lock, the writer must get it before the
+   second reader. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func reader_thread_func;
+static thread_func writer_thread_func;
+
+void
+test_priority_donate_rwlock (void) 
+{
+  struct rwlock rwlock;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&rwlock);
+  rwlock_acquire_shared (&rwlock);
+  thread_create ("reader1", PRI_DEFAULT + 1, reader_thread_func, &rwlock);
+  thread_create ("writer", PRI_DEFAULT + 2, writer_thread_func, &rwlock);
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 2, thread_get_priority ());
+  thread_create ("reader2", PRI_DEFAULT + 3, reader_thread_func, &rwlock);
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 3, thread_get_priority ());
+  rwlock_release (&rwlock);
+  msg ("writer, reader2 must already have finished.");
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT, thread_get_priority ());
+}
+
+static void
+reader_thread_func (void *rwlock_) 
+{
+  struct rwlock *rwlock = rwlock_;
+
+  rwlock_acquire_shared (rwlock);
+  msg ("%s: got the lock for reading", thread_name ());
+  rwlock_release (rwlock);
+  msg ("%s: done", thread_name ());
+}
+
+static void
+writer_thread_func (void *rwlock_) 
+{
+  struct rwlock *rwlock = rwlock_;
+
+  rwlock_acquire_exclusive (rwlock);
+  msg ("writer: got the lock for writing");
+  rwlock_release (rwlock);
+  msg ("writer: done");
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(priority-donate-rwlock) begin
+(priority-donate-rwlock) reader1: got the lock for reading
+(priority-donate-rwlock) reader1: done
+(priority-donate-rwlock) This thread should have priority 33.  Actual priority: 33.
+(priority-donate-rwlock) This thread should have priority 34.  Actual priority: 34.
+(priority-donate-rwlock) writer: got the lock for writing
+(priority-donate-rwlock) reader2: got the lock for reading
+(priority-donate-rwlock) reader2: done
+(priority-donate-rwlock) writer: done
+(priority-donate-rwlock) writer, reader2 must already have finished.
+(priority-donate-rwlock) This thread should have priority 31.  Actual priority: 31.
+(priority-donate-rwlock) end
+EOF
+pass;
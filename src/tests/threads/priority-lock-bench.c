@@ -0,0 +1,78 @@
+/* Microbenchmark for the lock fast path.  Times 100,000
+   uncontended lock_acquire()/lock_release() pairs, first with no
+   other locks held and then while holding 16 other locks, one of
+   which has a higher-priority waiter donating to us.  Neither
+   should involve any list work. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "devices/timer.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define ITER_CNT 100000
+#define HELD_CNT 16
+
+static thread_func waiter_thread_func;
+static uint64_t time_pairs (struct lock *);
+
+void
+test_priority_lock_bench (void)
+{
+  struct lock held[HELD_CNT];
+  struct lock lock;
+  uint64_t alone_ns, held_ns;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  lock_init (&lock);
+  alone_ns = time_pairs (&lock);
+
+  for (i = 0; i < HELD_CNT; i++)
+    {
+      lock_init (&held[i]);
+      lock_acquire (&held[i]);
+    }
+  thread_create ("waiter", PRI_DEFAULT + 1, waiter_thread_func, &held[0]);
+  msg ("Holding %d locks, priority %d.", HELD_CNT, thread_get_priority ());
+  held_ns = time_pairs (&lock);
+  for (i = HELD_CNT - 1; i >= 0; i--)
+    lock_release (&held[i]);
+
+  printf ("(priority-lock-bench) %d acquire/release pairs: %llu ns each "
+          "alone, %llu ns each holding %d locks\n",
+          ITER_CNT, alone_ns / ITER_CNT, held_ns / ITER_CNT, HELD_CNT);
+  msg ("Main thread finished, priority %d.", thread_get_priority ());
+  pass ();
+}
+
+/* Returns the time taken by ITER_CNT uncontended acquire/release
+   pairs on LOCK, in nanoseconds. */
+static uint64_t
+time_pairs (struct lock *lock)
+{
+  uint64_t start = timer_now_ns ();
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++)
+    {
+      lock_acquire (lock);
+      lock_release (lock);
+    }
+  return timer_now_ns () - start;
+}
+
+static void
+waiter_thread_func (void *lock_)
+{
+  struct lock *lock = lock_;
+
+  lock_acquire (lock);
+  lock_release (lock);
+}
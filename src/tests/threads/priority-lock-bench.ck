@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# The timings depend on the simulator, so just require that they
+# were reported.
+fail "Lock timings were not reported.\n"
+  if !grep (/^\(priority-lock-bench\) 100000 acquire\/release pairs: \d+ ns each alone, \d+ ns each holding 16 locks$/, @output);
+@output = grep (!/acquire\/release pairs/, @output);
+
+compare_output ("run", \@output, [<<'EOF']);
+(priority-lock-bench) begin
+(priority-lock-bench) Holding 16 locks, priority 32.
+(priority-lock-bench) Main thread finished, priority 31.
+(priority-lock-bench) PASS
+(priority-lock-bench) end
+EOF
+pass;
@@ -0,0 +1,75 @@
+/* Microbenchmark for the ready queue.  Creates 200 threads at the
+   same priority that yield to each other round-robin until 10,000
+   context switches have happened, and reports how many timer ticks
+   that took.  Every yield puts the running thread at the back of a
+   run queue holding all 200 threads. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "devices/timer.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define THREAD_CNT 200
+#define SWITCH_CNT 10000
+
+static thread_func yield_thread_func;
+
+/* Number of yields done so far by all threads. */
+static int yield_cnt;
+
+void
+test_priority_switch (void)
+{
+  int64_t start, elapsed;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  msg ("%d threads will yield %d times each.",
+       THREAD_CNT, SWITCH_CNT / THREAD_CNT);
+
+  yield_cnt = 0;
+  thread_set_priority (PRI_DEFAULT + 2);
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "yield %d", i);
+      if (thread_create (name, PRI_DEFAULT + 1, yield_thread_func, NULL)
+          == TID_ERROR)
+        fail ("thread_create() failed for thread %d", i);
+    }
+
+  /* Start at the beginning of a timer tick. */
+  start = timer_ticks ();
+  while (timer_ticks () == start)
+    continue;
+  start = timer_ticks ();
+
+  thread_set_priority (PRI_DEFAULT);
+  /* All the other threads now run to termination here. */
+  elapsed = timer_elapsed (start);
+
+  if (yield_cnt != SWITCH_CNT)
+    fail ("%d yields done, expected %d", yield_cnt, SWITCH_CNT);
+  printf ("(priority-switch) %d context switches took %lld ticks\n",
+          SWITCH_CNT, elapsed);
+  pass ();
+}
+
+static void
+yield_thread_func (void *aux UNUSED)
+{
+  int i;
+
+  for (i = 0; i < SWITCH_CNT / THREAD_CNT; i++)
+    {
+      yield_cnt++;
+      thread_yield ();
+    }
+}
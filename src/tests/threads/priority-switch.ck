@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# The tick count depends on the simulator, so just require that it
+# was reported.
+fail "Context switch time was not reported.\n"
+  if !grep (/^\(priority-switch\) 10000 context switches took \d+ ticks$/, @output);
+@output = grep (!/context switches took/, @output);
+
+compare_output ("run", \@output, [<<'EOF']);
+(priority-switch) begin
+(priority-switch) 200 threads will yield 50 times each.
+(priority-switch) PASS
+(priority-switch) end
+EOF
+pass;
@@ -0,0 +1,43 @@
+/* Writes, then reads back, 2 MB of memory in several linear
+   passes, so that each pass pages most of it out to swap and
+   back in, and verifies the values.  Used to measure swap
+   throughput: compare the "Timer:" and "Swap:" lines that the
+   kernel prints at shutdown. */
+
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+#define PASSES 4
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  int pass;
+  size_t i;
+
+  /* Give each page its own value. */
+  msg ("initialize");
+  for (i = 0; i < SIZE; i++)
+    buf[i] = i >> 12;
+
+  for (pass = 1; pass <= PASSES; pass++)
+    {
+      /* Read the previous pass's values back in and replace
+         them. */
+      msg ("read/modify/write pass %d", pass);
+      for (i = 0; i < SIZE; i++)
+        {
+          if (buf[i] != (char) ((i >> 12) + pass - 1))
+            fail ("byte %zu != %d", i, (char) ((i >> 12) + pass - 1));
+          buf[i]++;
+        }
+    }
+
+  msg ("read pass");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != (char) ((i >> 12) + PASSES))
+      fail ("byte %zu != %d", i, (char) ((i >> 12) + PASSES));
+}
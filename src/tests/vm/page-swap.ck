@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-swap) begin
+(page-swap) initialize
+(page-swap) read/modify/write pass 1
+(page-swap) read/modify/write pass 2
+(page-swap) read/modify/write pass 3
+(page-swap) read/modify/write pass 4
+(page-swap) read pass
+(page-swap) end
+EOF
+pass;
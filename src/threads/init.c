@@ -35,6 +35,7 @@
 #endif
 
 #include "vm/frame.h"
+#include "vm/page.h"
 
 #ifdef FILESYS
 #include "devices/block.h"
@@ -107,14 +108,15 @@ pintos_init (void)
 
   /* Initialize memory system. */
   palloc_init (user_page_limit);
-  malloc_init ();
   paging_init ();
+  malloc_init ();
 
 
   /* Segmentation. */
 #ifdef USERPROG
   /* Initialize frame table. */
   frame_init();
+  page_init();
   init_fs_lock();
 
   tss_init ();
@@ -148,6 +150,7 @@ pintos_init (void)
 
 #ifdef USERPROG
   swap_init();
+  pageout_init();
 #endif
 
   printf ("Boot complete.\n");
@@ -283,9 +286,17 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-malloc-tags"))
+        malloc_tags = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-pageout-low"))
+        pageout_low = atoi (value);
+      else if (!strcmp (name, "-pageout-high"))
+        pageout_high = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -408,8 +419,13 @@ usage (void)
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -malloc-tags       Record allocation sites of malloc blocks.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -pageout-low=COUNT Start paging out below COUNT free pages.\n"
+          "  -pageout-high=COUNT Stop paging out at COUNT free pages.\n"
 #endif
           );
   shutdown_power_off ();
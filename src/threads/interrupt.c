@@ -359,6 +359,9 @@ intr_handler (struct intr_frame *frame)
 
       in_external_intr = true;
       yield_on_return = false;
+
+      /* Restart the periodic timer if the idle thread stopped it. */
+      timer_idle_exit ();
     }
 
   /* Invoke the interrupt's handler. */
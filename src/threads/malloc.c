@@ -1,11 +1,14 @@
 #include "threads/malloc.h"
+#include <bitmap.h>
 #include <debug.h>
 #include <list.h>
 #include <round.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/init.h"
 #include "threads/palloc.h"
+#include "threads/pte.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
@@ -30,9 +33,23 @@
 
    We can't handle blocks bigger than 2 kB using this scheme,
    because they're too big to fit in a single page with a
-   descriptor.  We handle those by allocating contiguous pages
-   with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   descriptor.  We handle those by allocating pages one at a time
+   and mapping them at consecutive addresses in a "window" of
+   kernel virtual memory past the end of RAM, so that they need
+   not be physically contiguous, and sticking the allocation size
+   at the beginning of the allocated block's arena header.  The
+   window's page tables are set up at boot, before any process
+   page directory copies the kernel's, so mappings made later are
+   seen by every address space.  realloc() grows a big block in
+   place when the window pages after it are unused.  If the
+   window is full, we fall back to contiguous pages from the page
+   allocator.
+
+   With the -malloc-tags kernel option, every block is preceded
+   by a tag that records the requested size and the return
+   address of the call that allocated it, and that links it into
+   a list of live blocks.  malloc_print_stats() dumps that list at
+   shutdown, which shows what leaked and from where. */
 
 /* Descriptor. */
 struct desc
@@ -41,6 +58,15 @@ struct desc
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
     struct lock lock;           /* Lock. */
+
+    /* Statistics, protected by LOCK. */
+    size_t in_use;              /* Blocks allocated. */
+    size_t peak;                /* Most blocks ever allocated. */
+    size_t arena_cnt;           /* Arenas allocated. */
+    long long allocs;           /* Successful allocations. */
+    long long frees;            /* Frees. */
+    long long failures;         /* Failed allocations. */
+    long long contended;        /* Times LOCK was already held. */
   };
 
 /* Magic number for detecting arena corruption. */
@@ -64,8 +90,51 @@ struct block
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Statistics for big blocks, protected by window_lock. */
+static size_t big_pages;        /* Pages in big blocks. */
+static size_t big_peak;         /* Most pages ever in big blocks. */
+static long long big_allocs;    /* Successful big allocations. */
+static long long big_frees;     /* Big block frees. */
+static long long big_failures;  /* Failed big allocations. */
+
+/* Magic number for detecting tag corruption. */
+#define TAG_MAGIC 0x7a6b1c0d
+
+/* Allocation-site tag, in front of each block if malloc_tags. */
+struct tag
+  {
+    struct list_elem elem;      /* Element in live_tags. */
+    void *caller;               /* Return address of allocating call. */
+    size_t size;                /* Requested size in bytes. */
+    unsigned seq;               /* Allocation sequence number. */
+    unsigned magic;             /* Always set to TAG_MAGIC. */
+  };
+
+/* -malloc-tags: Tag each block with its allocation site. */
+bool malloc_tags;
+
+static struct list live_tags;   /* Tags of all live blocks. */
+static struct lock tag_lock;    /* Protects live_tags, tag_seq. */
+static unsigned tag_seq;        /* Next allocation sequence number. */
+
+/* Window for big blocks. */
+#define WINDOW_PAGES 4096       /* Size of window, in pages. */
+static uint8_t *window_base;    /* First page of window. */
+static uint32_t *window_ptes;   /* Page table entries for window. */
+static struct bitmap *window_map; /* Window pages in use. */
+static struct lock window_lock; /* Protects window_map. */
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static void *block_alloc (size_t);
+static void block_free (void *);
+static void *alloc_from (size_t, void *caller);
+static void desc_lock (struct desc *);
+static void big_account (long long page_delta, long long *counter);
+static void window_init (void);
+static void *big_alloc (size_t page_cnt);
+static void big_free (struct arena *);
+static bool big_resize (struct arena *, size_t page_cnt);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -82,12 +151,52 @@ malloc_init (void)
       list_init (&d->free_list);
       lock_init (&d->lock);
     }
+
+  list_init (&live_tags);
+  lock_init (&tag_lock);
+  window_init ();
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) 
+{
+  return alloc_from (size, __builtin_return_address (0));
+}
+
+/* Obtains and returns a new block of at least SIZE bytes, for a
+   call from CALLER.  Returns a null pointer if memory is not
+   available. */
+static void *
+alloc_from (size_t size, void *caller)
+{
+  struct tag *t;
+
+  if (!malloc_tags)
+    return block_alloc (size);
+
+  /* A null pointer satisfies a request for 0 bytes. */
+  if (size == 0 || size + sizeof *t < size)
+    return NULL;
+
+  t = block_alloc (size + sizeof *t);
+  if (t == NULL)
+    return NULL;
+  t->caller = caller;
+  t->size = size;
+  t->magic = TAG_MAGIC;
+  lock_acquire (&tag_lock);
+  t->seq = tag_seq++;
+  list_push_back (&live_tags, &t->elem);
+  lock_release (&tag_lock);
+  return t + 1;
+}
+
+/* Obtains and returns a new untagged block of at least SIZE
+   bytes.  Returns a null pointer if memory is not available. */
+static void *
+block_alloc (size_t size) 
 {
   struct desc *d;
   struct block *b;
@@ -107,7 +216,9 @@ malloc (size_t size)
       /* SIZE is too big for any descriptor.
          Allocate enough pages to hold SIZE plus an arena. */
       size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
-      a = palloc_get_multiple (0, page_cnt);
+      a = big_alloc (page_cnt);
+      big_account (a != NULL ? (long long) page_cnt : 0,
+                   a != NULL ? &big_allocs : &big_failures);
       if (a == NULL)
         return NULL;
 
@@ -119,7 +230,7 @@ malloc (size_t size)
       return a + 1;
     }
 
-  lock_acquire (&d->lock);
+  desc_lock (d);
 
   /* If the free list is empty, create a new arena. */
   if (list_empty (&d->free_list))
@@ -130,9 +241,11 @@ malloc (size_t size)
       a = palloc_get_page (0);
       if (a == NULL) 
         {
+          d->failures++;
           lock_release (&d->lock);
           return NULL; 
         }
+      d->arena_cnt++;
 
       /* Initialize arena and add its blocks to the free list. */
       a->magic = ARENA_MAGIC;
@@ -149,6 +262,9 @@ malloc (size_t size)
   b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
   a = block_to_arena (b);
   a->free_cnt--;
+  d->allocs++;
+  if (++d->in_use > d->peak)
+    d->peak = d->in_use;
   lock_release (&d->lock);
   return b;
 }
@@ -167,7 +283,7 @@ calloc (size_t a, size_t b)
     return NULL;
 
   /* Allocate and zero memory. */
-  p = malloc (size);
+  p = alloc_from (size, __builtin_return_address (0));
   if (p != NULL)
     memset (p, 0, size);
 
@@ -199,6 +315,34 @@ realloc (void *old_block, size_t new_size)
       free (old_block);
       return NULL;
     }
+  else if (malloc_tags)
+    {
+      /* Always move a tagged block, so that its tag records the
+         new size and the site that resized it. */
+      void *new_block = alloc_from (new_size, __builtin_return_address (0));
+      if (old_block != NULL && new_block != NULL)
+        {
+          size_t old_size = ((struct tag *) old_block - 1)->size;
+          memcpy (new_block, old_block,
+                  new_size < old_size ? new_size : old_size);
+          free (old_block);
+        }
+      return new_block;
+    }
+  else if (old_block != NULL && new_size <= block_size (old_block))
+    {
+      /* Fits where it is.  Give back whole pages a big block no
+         longer needs. */
+      struct arena *a = block_to_arena (old_block);
+      if (a->desc == NULL)
+        big_resize (a, DIV_ROUND_UP (new_size + sizeof *a, PGSIZE));
+      return old_block;
+    }
+  else if (old_block != NULL && block_to_arena (old_block)->desc == NULL
+           && big_resize (block_to_arena (old_block),
+                          DIV_ROUND_UP (new_size + sizeof (struct arena),
+                                        PGSIZE)))
+    return old_block;
   else 
     {
       void *new_block = malloc (new_size);
@@ -217,6 +361,25 @@ realloc (void *old_block, size_t new_size)
    malloc(), calloc(), or realloc(). */
 void
 free (void *p) 
+{
+  if (p != NULL && malloc_tags)
+    {
+      struct tag *t = (struct tag *) p - 1;
+
+      ASSERT (t->magic == TAG_MAGIC);
+      t->magic = 0;
+      lock_acquire (&tag_lock);
+      list_remove (&t->elem);
+      lock_release (&tag_lock);
+      p = t;
+    }
+  block_free (p);
+}
+
+/* Frees untagged block P, which must have been previously
+   allocated with block_alloc(). */
+static void
+block_free (void *p) 
 {
   if (p != NULL)
     {
@@ -233,7 +396,9 @@ free (void *p)
           memset (b, 0xcc, d->block_size);
 #endif
   
-          lock_acquire (&d->lock);
+          desc_lock (d);
+          d->frees++;
+          d->in_use--;
 
           /* Add block to free list. */
           list_push_front (&d->free_list, &b->free_elem);
@@ -250,6 +415,7 @@ free (void *p)
                   list_remove (&b->free_elem);
                 }
               palloc_free_page (a);
+              d->arena_cnt--;
             }
 
           lock_release (&d->lock);
@@ -257,12 +423,90 @@ free (void *p)
       else
         {
           /* It's a big block.  Free its pages. */
-          palloc_free_multiple (a, a->free_cnt);
+          big_account (-(long long) a->free_cnt, &big_frees);
+          big_free (a);
           return;
         }
     }
 }
 
+/* Most live tagged blocks that malloc_print_stats() lists. */
+#define TAG_DUMP_MAX 50
+
+/* Prints malloc statistics and, with -malloc-tags, the blocks
+   that are still allocated and the sites that allocated them. */
+void
+malloc_print_stats (void)
+{
+  size_t i;
+
+  for (i = 0; i < desc_cnt; i++)
+    {
+      struct desc *d = &descs[i];
+
+      lock_acquire (&d->lock);
+      if (d->allocs > 0)
+        printf ("Malloc: %zu-byte blocks: %zu in use, peak %zu, "
+                "%zu arenas, %lld allocs, %lld frees, %lld failed, "
+                "%lld contended\n",
+                d->block_size, d->in_use, d->peak, d->arena_cnt,
+                d->allocs, d->frees, d->failures, d->contended);
+      lock_release (&d->lock);
+    }
+
+  lock_acquire (&window_lock);
+  printf ("Malloc: big blocks: %zu pages in use, peak %zu, "
+          "%lld allocs, %lld frees, %lld failed\n",
+          big_pages, big_peak, big_allocs, big_frees, big_failures);
+  lock_release (&window_lock);
+
+  if (malloc_tags)
+    {
+      struct list_elem *e;
+      size_t cnt = 0;
+
+      lock_acquire (&tag_lock);
+      for (e = list_begin (&live_tags); e != list_end (&live_tags);
+           e = list_next (e), cnt++)
+        if (cnt < TAG_DUMP_MAX)
+          {
+            struct tag *t = list_entry (e, struct tag, elem);
+            printf ("Malloc: live block %p: %zu bytes from %p (#%u)\n",
+                    t + 1, t->size, t->caller, t->seq);
+          }
+      lock_release (&tag_lock);
+      if (cnt > TAG_DUMP_MAX)
+        printf ("Malloc: ... and %zu more live blocks\n",
+                cnt - TAG_DUMP_MAX);
+    }
+}
+
+/* Acquires D's lock, counting the acquisition as contended if
+   another thread already holds it. */
+static void
+desc_lock (struct desc *d)
+{
+  if (!lock_try_acquire (&d->lock))
+    {
+      lock_acquire (&d->lock);
+      d->contended++;
+    }
+}
+
+/* Adds PAGE_DELTA to the pages in big blocks and, if COUNTER is
+   nonnull, increments *COUNTER. */
+static void
+big_account (long long page_delta, long long *counter)
+{
+  lock_acquire (&window_lock);
+  big_pages += page_delta;
+  if (big_pages > big_peak)
+    big_peak = big_pages;
+  if (counter != NULL)
+    (*counter)++;
+  lock_release (&window_lock);
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
@@ -292,3 +536,171 @@ arena_to_block (struct arena *a, size_t idx)
                            + sizeof *a
                            + idx * a->desc->block_size);
 }
+
+/* Returns true if big block arena A lies in the window. */
+static bool
+in_window (const struct arena *a)
+{
+  return ((uint8_t *) a >= window_base
+          && (uint8_t *) a < window_base + WINDOW_PAGES * PGSIZE);
+}
+
+/* Flushes the TLB entry for kernel virtual address VADDR. */
+static inline void
+invalidate_page (void *vaddr)
+{
+  asm volatile ("invlpg (%0)" : : "r" (vaddr) : "memory");
+}
+
+/* Sets up the window for big blocks, just past the end of RAM in
+   kernel virtual memory, and the page tables that map it. */
+static void
+window_init (void)
+{
+  size_t pt_cnt = DIV_ROUND_UP (WINDOW_PAGES, PGSIZE / sizeof (uint32_t));
+  size_t i;
+
+  window_base = ptov (ROUND_UP (init_ram_pages * PGSIZE, PTSPAN));
+  ASSERT ((uintptr_t) window_base + WINDOW_PAGES * PGSIZE
+          > (uintptr_t) window_base);
+
+  window_ptes = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, pt_cnt);
+  for (i = 0; i < pt_cnt; i++)
+    init_page_dir[pd_no (window_base + i * PTSPAN)]
+      = pde_create (window_ptes + i * (PGSIZE / sizeof (uint32_t)));
+
+  window_map = bitmap_create (WINDOW_PAGES);
+  if (window_map == NULL)
+    PANIC ("Not enough memory for malloc window.");
+  lock_init (&window_lock);
+}
+
+/* Maps PAGE_CNT newly allocated pages at window pages starting at
+   PAGE_IDX, which must be reserved in window_map.  Returns true
+   if successful, false if memory ran out, in which case nothing
+   is mapped. */
+static bool
+window_map_pages (size_t page_idx, size_t page_cnt)
+{
+  size_t i;
+
+  for (i = 0; i < page_cnt; i++)
+    {
+      void *kpage = palloc_get_page (0);
+      if (kpage == NULL)
+        {
+          while (i-- > 0)
+            {
+              palloc_free_page (pte_get_page (window_ptes[page_idx + i]));
+              window_ptes[page_idx + i] = 0;
+              invalidate_page (window_base + (page_idx + i) * PGSIZE);
+            }
+          return false;
+        }
+      window_ptes[page_idx + i] = pte_create_kernel (kpage, true);
+    }
+  return true;
+}
+
+/* Unmaps and frees the PAGE_CNT window pages starting at
+   PAGE_IDX and releases them in window_map. */
+static void
+window_unmap_pages (size_t page_idx, size_t page_cnt)
+{
+  size_t i;
+
+  for (i = 0; i < page_cnt; i++)
+    {
+      palloc_free_page (pte_get_page (window_ptes[page_idx + i]));
+      window_ptes[page_idx + i] = 0;
+      invalidate_page (window_base + (page_idx + i) * PGSIZE);
+    }
+
+  lock_acquire (&window_lock);
+  bitmap_set_multiple (window_map, page_idx, page_cnt, false);
+  lock_release (&window_lock);
+}
+
+/* Obtains PAGE_CNT pages for a big block, in the window if
+   possible, or else physically contiguous.  Returns a null
+   pointer if memory is not available. */
+static void *
+big_alloc (size_t page_cnt)
+{
+  size_t page_idx;
+
+  lock_acquire (&window_lock);
+  page_idx = bitmap_scan_and_flip (window_map, 0, page_cnt, false);
+  lock_release (&window_lock);
+
+  if (page_idx == BITMAP_ERROR)
+    return palloc_get_multiple (0, page_cnt);
+  if (!window_map_pages (page_idx, page_cnt))
+    {
+      lock_acquire (&window_lock);
+      bitmap_set_multiple (window_map, page_idx, page_cnt, false);
+      lock_release (&window_lock);
+      return NULL;
+    }
+  return window_base + page_idx * PGSIZE;
+}
+
+/* Frees the pages of big block arena A. */
+static void
+big_free (struct arena *a)
+{
+  if (in_window (a))
+    window_unmap_pages (pg_no (a) - pg_no (window_base), a->free_cnt);
+  else
+    palloc_free_multiple (a, a->free_cnt);
+}
+
+/* Tries to resize big block arena A to PAGE_CNT pages without
+   moving it, by freeing its surplus pages or by mapping new ones
+   after it if those window pages are unused.  Returns true if
+   successful, false if A must move to grow. */
+static bool
+big_resize (struct arena *a, size_t page_cnt)
+{
+  size_t page_idx, old_cnt = a->free_cnt;
+  bool success = false;
+
+  ASSERT (a->desc == NULL);
+
+  if (!in_window (a))
+    return page_cnt <= old_cnt;
+
+  page_idx = pg_no (a) - pg_no (window_base);
+  if (page_cnt <= old_cnt)
+    {
+      if (page_cnt < old_cnt)
+        window_unmap_pages (page_idx + page_cnt, old_cnt - page_cnt);
+      big_account ((long long) page_cnt - (long long) old_cnt, NULL);
+      a->free_cnt = page_cnt;
+      return true;
+    }
+
+  lock_acquire (&window_lock);
+  if (page_idx + page_cnt <= WINDOW_PAGES
+      && bitmap_none (window_map, page_idx + old_cnt, page_cnt - old_cnt))
+    {
+      bitmap_set_multiple (window_map, page_idx + old_cnt,
+                           page_cnt - old_cnt, true);
+      success = true;
+    }
+  lock_release (&window_lock);
+  if (!success)
+    return false;
+
+  if (!window_map_pages (page_idx + old_cnt, page_cnt - old_cnt))
+    {
+      lock_acquire (&window_lock);
+      bitmap_set_multiple (window_map, page_idx + old_cnt,
+                           page_cnt - old_cnt, false);
+      lock_release (&window_lock);
+      return false;
+    }
+  big_account ((long long) page_cnt - (long long) old_cnt, NULL);
+  a->free_cnt = page_cnt;
+  return true;
+}
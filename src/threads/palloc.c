@@ -1,7 +1,7 @@
 #include "threads/palloc.h"
-#include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -9,7 +9,7 @@
 #include <string.h>
 #include <lib/debug.h>
 #include "threads/loader.h"
-#include "threads/synch.h"
+#include "threads/interrupt.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -24,14 +24,69 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is managed as a buddy system.  Its free memory is
+   kept as blocks of 2**ORDER pages, aligned to their size
+   relative to the pool base, on one free list per order.  An
+   allocation takes the smallest block that fits, splitting it
+   down as needed, and gives the unused tail back; a free splits
+   the range into aligned blocks and merges each with its free
+   buddy.  Both take O(log n) time.  They run with interrupts off
+   rather than under a lock, since thread_schedule_tail() frees
+   the page of a dying thread where it cannot sleep.
+
+   Single pages mostly bypass the buddy system.  Each pool keeps
+   a magazine of free pages that single-page requests pop and
+   single-page frees push; it is refilled from and drained to the
+   buddy system MAG_BATCH pages at a time.
+
+   Free pages already filled with zeros are kept apart on a
+   zeroed list, so that a PAL_ZERO request for a single page is
+   usually just a pop.  The idle thread fills it one page at a
+   time through palloc_zero_page(): in the user pool, where every
+   page handed to a process must be clear, with all free pages,
+   and in the kernel pool with up to MAG_SIZE of them.  The list
+   is threaded through the pages themselves, so the list element
+   at the start of a page is cleared when the page is taken. */
+
+/* Number of block orders.  The largest block is 2**(ORDERS - 1)
+   pages. */
+#define ORDERS 20
+
+/* Per-page state, kept in the pool's page_state array. */
+#define PAGE_USED 0xff                  /* Allocated. */
+#define PAGE_FREE 0x40                  /* Head of a free block, with
+                                           the block's order in the
+                                           low bits. */
+/* Any other page is inside a free block (state 0). */
+
+/* Capacity of a magazine, and the number of pages moved between
+   a magazine and the buddy system at once. */
+#define MAG_SIZE 32
+#define MAG_BATCH 16
 
 /* A memory pool. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
-    struct bitmap *used_map;            /* Bitmap of free pages. */
+    uint8_t *page_state;                /* State of each page. */
+    struct list free_lists[ORDERS];     /* Free blocks, by order. */
+    size_t page_cnt;                    /* Number of pages. */
+    size_t free_cnt;                    /* Number of free pages. */
     uint8_t *base;                      /* Base of pool. */
+
+    void *mag[MAG_SIZE];                /* Cached free pages. */
+    size_t mag_cnt;                     /* Number of cached pages. */
+    struct list zero_list;              /* Free pages full of zeros. */
+    size_t zero_cnt;                    /* Number of zeroed pages. */
+    size_t zero_max;                    /* Most zeroed pages to keep. */
+
+    /* Statistics. */
+    size_t used_cnt;                    /* Pages handed out. */
+    size_t used_peak;                   /* Most pages ever handed out. */
+    long long allocs;                   /* Successful allocations. */
+    long long frees;                    /* Calls to free pages. */
+    long long failures;                 /* Failed allocations. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -40,6 +95,13 @@ static struct pool kernel_pool, user_pool;
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static void free_range (struct pool *, size_t page_idx, size_t page_cnt);
+static void *mag_get (struct pool *, bool zero, bool *zeroed);
+static void mag_put (struct pool *, void *page);
+static void mag_drain (struct pool *);
+static void *zero_get (struct pool *);
+static bool zero_one (struct pool *);
+static void print_pool_stats (struct pool *, const char *name);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -60,6 +122,75 @@ palloc_init (size_t user_page_limit)
   init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
   init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
              user_pages, "user pool");
+
+  /* Every page a process gets must be clear, so keep all of the
+     user pool's free pages zeroed if the idle thread can. */
+  user_pool.zero_max = SIZE_MAX;
+}
+
+/* Returns the address of page PAGE_IDX in POOL. */
+static inline uint8_t *
+page_addr (const struct pool *pool, size_t page_idx)
+{
+  return pool->base + PGSIZE * page_idx;
+}
+
+/* Returns the smallest order whose blocks hold PAGE_CNT pages. */
+static int
+order_for (size_t page_cnt)
+{
+  int order = 0;
+
+  while (((size_t) 1 << order) < page_cnt)
+    order++;
+  return order;
+}
+
+/* Takes a block of at least PAGE_CNT pages off POOL's free
+   lists, splits it down to the smallest order that fits, and
+   frees whatever of it lies beyond the first PAGE_CNT pages.  Returns the
+   index of the first page, or SIZE_MAX if no block is large
+   enough.  Interrupts must be off. */
+static size_t
+alloc_pages (struct pool *pool, size_t page_cnt)
+{
+  int want = order_for (page_cnt);
+  int order;
+  size_t page_idx, i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (order = want; order < ORDERS; order++)
+    if (!list_empty (&pool->free_lists[order]))
+      break;
+  if (order >= ORDERS)
+    return SIZE_MAX;
+
+  page_idx = pg_no (list_pop_front (&pool->free_lists[order]))
+             - pg_no (pool->base);
+  pool->free_cnt -= (size_t) 1 << order;
+
+  /* Split off upper halves until the block is the right size. */
+  while (order > want)
+    {
+      size_t buddy;
+
+      order--;
+      buddy = page_idx + ((size_t) 1 << order);
+      pool->page_state[buddy] = PAGE_FREE | order;
+      list_push_front (&pool->free_lists[order],
+                       (struct list_elem *) page_addr (pool, buddy));
+      pool->free_cnt += (size_t) 1 << order;
+    }
+
+  for (i = 0; i < ((size_t) 1 << want); i++)
+    pool->page_state[page_idx + i] = PAGE_USED;
+
+  /* Give back the tail of a block larger than requested. */
+  if (page_cnt < ((size_t) 1 << want))
+    free_range (pool, page_idx + page_cnt, ((size_t) 1 << want) - page_cnt);
+
+  return page_idx;
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -72,24 +203,43 @@ void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
-  void *pages;
+  enum intr_level old_level;
+  void *pages = NULL;
+  bool zeroed = false;
   size_t page_idx;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
-
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
+  old_level = intr_disable ();
+  if (page_cnt == 1)
+    pages = mag_get (pool, flags & PAL_ZERO, &zeroed);
   else
-    pages = NULL;
+    {
+      page_idx = alloc_pages (pool, page_cnt);
+      if (page_idx == SIZE_MAX)
+        {
+          /* The cached pages may complete a large enough block. */
+          mag_drain (pool);
+          page_idx = alloc_pages (pool, page_cnt);
+        }
+      if (page_idx != SIZE_MAX)
+        pages = page_addr (pool, page_idx);
+    }
+  if (pages != NULL)
+    {
+      pool->allocs++;
+      pool->used_cnt += page_cnt;
+      if (pool->used_cnt > pool->used_peak)
+        pool->used_peak = pool->used_cnt;
+    }
+  else
+    pool->failures++;
+  intr_set_level (old_level);
 
   if (pages != NULL) 
     {
-      if (flags & PAL_ZERO)
+      if ((flags & PAL_ZERO) && !zeroed)
         memset (pages, 0, PGSIZE * page_cnt);
     }
   else 
@@ -119,6 +269,7 @@ void
 palloc_free_multiple (void *pages, size_t page_cnt) 
 {
   struct pool *pool;
+  enum intr_level old_level;
   size_t page_idx;
 
   ASSERT (pg_ofs (pages) == 0);
@@ -138,8 +289,14 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
-  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  old_level = intr_disable ();
+  pool->frees++;
+  pool->used_cnt -= page_cnt;
+  if (page_cnt == 1)
+    mag_put (pool, pages);
+  else
+    free_range (pool, page_idx, page_cnt);
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -149,25 +306,266 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Zeros one free page ahead of PAL_ZERO requests, preferring
+   the user pool.  Returns false if there was nothing left to
+   zero.  Zeroing runs with interrupts on, so this is meant to be
+   called by the idle thread, one page at a time for as long as
+   no other thread is ready. */
+bool
+palloc_zero_page (void)
+{
+  return zero_one (&user_pool) || zero_one (&kernel_pool);
+}
+
+/* Returns the number of free pages in the user pool. */
+size_t
+palloc_user_free_cnt (void)
+{
+  return user_pool.page_cnt - user_pool.used_cnt;
+}
+
+/* Prints the free memory and fragmentation of each pool. */
+void
+palloc_print_stats (void)
+{
+  print_pool_stats (&kernel_pool, "kernel pool");
+  print_pool_stats (&user_pool, "user pool");
+}
+
+/* Moves up to MAG_BATCH free pages from POOL's buddy system into
+   its magazine, as one block if possible.  Interrupts must be
+   off. */
+static void
+mag_refill (struct pool *pool)
+{
+  size_t page_idx, i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (pool->mag_cnt + MAG_BATCH <= MAG_SIZE);
+
+  page_idx = alloc_pages (pool, MAG_BATCH);
+  if (page_idx != SIZE_MAX)
+    {
+      for (i = MAG_BATCH; i-- > 0; )
+        pool->mag[pool->mag_cnt++] = page_addr (pool, page_idx + i);
+      return;
+    }
+
+  while (pool->mag_cnt < MAG_BATCH
+         && (page_idx = alloc_pages (pool, 1)) != SIZE_MAX)
+    pool->mag[pool->mag_cnt++] = page_addr (pool, page_idx);
+}
+
+/* Returns a free page from POOL's magazines, refilling them if
+   they are empty, or a null pointer if POOL has no free page.
+   Prefers a zeroed page if ZERO is true, and any other page
+   otherwise.  Sets *ZEROED to true if the page is known to be
+   full of zeros.  Interrupts must be off. */
+static void *
+mag_get (struct pool *pool, bool zero, bool *zeroed)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (zero && pool->zero_cnt > 0)
+    {
+      *zeroed = true;
+      return zero_get (pool);
+    }
+  if (pool->mag_cnt == 0)
+    mag_refill (pool);
+  if (pool->mag_cnt > 0)
+    return pool->mag[--pool->mag_cnt];
+  if (pool->zero_cnt > 0)
+    {
+      *zeroed = true;
+      return zero_get (pool);
+    }
+  return NULL;
+}
+
+/* Returns free PAGE to POOL's magazine, first draining the
+   MAG_BATCH least recently freed pages to the buddy system if
+   it is full.  Interrupts must be off. */
+static void
+mag_put (struct pool *pool, void *page)
+{
+  size_t i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (pool->mag_cnt == MAG_SIZE)
+    {
+      for (i = 0; i < MAG_BATCH; i++)
+        free_range (pool, pg_no (pool->mag[i]) - pg_no (pool->base), 1);
+      pool->mag_cnt -= MAG_BATCH;
+      memmove (pool->mag, pool->mag + MAG_BATCH,
+               pool->mag_cnt * sizeof *pool->mag);
+    }
+  pool->mag[pool->mag_cnt++] = page;
+}
+
+/* Returns every page in POOL's magazines to the buddy system.
+   Interrupts must be off. */
+static void
+mag_drain (struct pool *pool)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (pool->mag_cnt > 0)
+    free_range (pool, pg_no (pool->mag[--pool->mag_cnt])
+                      - pg_no (pool->base), 1);
+  while (pool->zero_cnt > 0)
+    free_range (pool, pg_no (zero_get (pool)) - pg_no (pool->base), 1);
+}
+
+/* Takes a page off POOL's zeroed list, which must not be empty,
+   and clears the list element at its start.  Interrupts must be
+   off. */
+static void *
+zero_get (struct pool *pool)
+{
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (pool->zero_cnt > 0);
+
+  e = list_pop_front (&pool->zero_list);
+  pool->zero_cnt--;
+  memset (e, 0, sizeof *e);
+  return e;
+}
+
+/* Zeros one free page from POOL's buddy system onto its zeroed
+   list.  Returns false if the list is at its limit or POOL has
+   no other free page. */
+static bool
+zero_one (struct pool *pool)
+{
+  enum intr_level old_level;
+  size_t page_idx = SIZE_MAX;
+  void *page;
+
+  old_level = intr_disable ();
+  if (pool->zero_cnt < pool->zero_max)
+    page_idx = alloc_pages (pool, 1);
+  intr_set_level (old_level);
+  if (page_idx == SIZE_MAX)
+    return false;
+
+  page = page_addr (pool, page_idx);
+  memset (page, 0, PGSIZE);
+
+  old_level = intr_disable ();
+  list_push_front (&pool->zero_list, (struct list_elem *) page);
+  pool->zero_cnt++;
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Returns the free block of order ORDER that is the buddy of the
+   block of that order at PAGE_IDX in POOL, or SIZE_MAX if its
+   buddy is not a free block of the same order. */
+static size_t
+free_buddy (const struct pool *pool, size_t page_idx, int order)
+{
+  size_t buddy = page_idx ^ ((size_t) 1 << order);
+
+  if (buddy + ((size_t) 1 << order) > pool->page_cnt
+      || pool->page_state[buddy] != (PAGE_FREE | order))
+    return SIZE_MAX;
+  return buddy;
+}
+
+/* Frees the block of 2**ORDER pages at PAGE_IDX in POOL, merging
+   it with its buddy for as long as the buddy is free. */
+static void
+free_block (struct pool *pool, size_t page_idx, int order)
+{
+  size_t buddy;
+
+  pool->free_cnt += (size_t) 1 << order;
+  while (order < ORDERS - 1
+         && (buddy = free_buddy (pool, page_idx, order)) != SIZE_MAX)
+    {
+      list_remove ((struct list_elem *) page_addr (pool, buddy));
+      pool->page_state[buddy] = 0;
+      pool->page_state[page_idx] = 0;
+      if (buddy < page_idx)
+        page_idx = buddy;
+      order++;
+    }
+
+  pool->page_state[page_idx] = PAGE_FREE | order;
+  list_push_front (&pool->free_lists[order],
+                   (struct list_elem *) page_addr (pool, page_idx));
+}
+
+/* Frees the PAGE_CNT used pages starting at PAGE_IDX in POOL, as
+   the largest aligned blocks that cover them.  Interrupts must
+   be off. */
+static void
+free_range (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (page_idx + page_cnt <= pool->page_cnt);
+
+  while (page_cnt > 0)
+    {
+      int order = 0;
+      size_t i;
+
+      while (order < ORDERS - 1
+             && (page_idx & ((size_t) 1 << order)) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+
+      for (i = 0; i < ((size_t) 1 << order); i++)
+        {
+          ASSERT (pool->page_state[page_idx + i] == PAGE_USED);
+          pool->page_state[page_idx + i] = 0;
+        }
+      free_block (pool, page_idx, order);
+
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
-    PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
+  enum intr_level old_level;
+  int order;
+
+  /* We'll put the pool's page_state array at its base.
+     Calculate the space needed for it and subtract it from the
+     pool's size. */
+  size_t state_pages = DIV_ROUND_UP (page_cnt, PGSIZE);
+  if (state_pages > page_cnt)
+    PANIC ("Not enough memory in %s for page state.", name);
+  page_cnt -= state_pages;
 
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
-  /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  /* Initialize the pool, then free all of its pages. */
+  p->page_state = base;
+  memset (p->page_state, PAGE_USED, page_cnt);
+  for (order = 0; order < ORDERS; order++)
+    list_init (&p->free_lists[order]);
+  p->page_cnt = page_cnt;
+  p->free_cnt = 0;
+  p->mag_cnt = p->zero_cnt = 0;
+  p->used_cnt = p->used_peak = 0;
+  p->allocs = p->frees = p->failures = 0;
+  list_init (&p->zero_list);
+  p->zero_max = MAG_SIZE;
+  p->base = (uint8_t *) base + state_pages * PGSIZE;
+
+  old_level = intr_disable ();
+  free_range (p, 0, page_cnt);
+  intr_set_level (old_level);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -177,7 +575,39 @@ page_from_pool (const struct pool *pool, void *page)
 {
   size_t page_no = pg_no (page);
   size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t end_page = start_page + pool->page_cnt;
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Prints POOL's usage counters, free pages and free blocks by
+   order.  There is no lock contention to report: pools are
+   guarded by turning interrupts off.  The
+   largest free block bounds the biggest request that can still
+   succeed; free pages scattered in small blocks show
+   fragmentation. */
+static void
+print_pool_stats (struct pool *pool, const char *name)
+{
+  size_t largest = 0;
+  int order;
+
+  printf ("Palloc: %s: %zu pages in use, peak %zu, %lld allocs, "
+          "%lld frees, %lld failed\n", name, pool->used_cnt,
+          pool->used_peak, pool->allocs, pool->frees, pool->failures);
+  printf ("Palloc: %s: %zu of %zu pages free, free blocks by order:",
+          name, pool->free_cnt, pool->page_cnt);
+  for (order = 0; order < ORDERS; order++)
+    {
+      size_t cnt = list_size (&pool->free_lists[order]);
+      if (cnt != 0)
+        {
+          printf (" %d:%zu", order, cnt);
+          largest = (size_t) 1 << order;
+        }
+    }
+  printf ("\n");
+  printf ("Palloc: %s: largest free block %zu pages, "
+          "%zu pages cached, %zu of them zeroed\n", name, largest,
+          pool->mag_cnt + pool->zero_cnt, pool->zero_cnt);
+}
@@ -0,0 +1,244 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* An object cache ("slab allocator").
+
+   malloc() rounds every request up to a power of 2, which wastes
+   up to half of each block for fixed-size kernel structures.  A
+   cache instead hands out objects of one exact size, packed into
+   page-size "slabs" with a small header at the start.
+
+   Each slab keeps its own list of free objects.  The cache keeps
+   the slabs that have a free object on a list, and allocates
+   from the first of them, creating a new slab when there is
+   none.  When a slab becomes entirely free it is given back to
+   the page allocator, unless it is the cache's only slab with
+   free objects, which is kept to avoid thrashing.
+
+   If the cache has a constructor, it is run on each object once,
+   when the object's slab is created, and a freed object must be
+   left in its constructed state.  Such objects keep their
+   free-list link after the object rather than in it. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Object cache. */
+struct kmem_cache
+  {
+    const char *name;           /* Name, for statistics. */
+    size_t obj_size;            /* Size of each object in bytes. */
+    size_t stride;              /* Distance between objects. */
+    size_t link_ofs;            /* Offset of free-list link in object. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    kmem_ctor_func *ctor;       /* Constructor, or null. */
+    struct list partial;        /* Slabs with a free object. */
+    struct lock lock;           /* Lock. */
+
+    /* Statistics. */
+    size_t slab_cnt;            /* Slabs allocated. */
+    size_t in_use;              /* Objects allocated. */
+    size_t peak;                /* Most objects ever allocated. */
+    long long allocs;           /* Calls to kmem_cache_alloc(). */
+    long long frees;            /* Calls to kmem_cache_free(). */
+  };
+
+/* Slab header, at the start of each slab's page. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in cache's partial list. */
+    size_t free_cnt;            /* Number of free objects. */
+    void *free;                 /* First free object. */
+  };
+
+/* Our set of caches. */
+static struct kmem_cache caches[16];
+static size_t cache_cnt;
+
+static struct slab *obj_to_slab (void *);
+
+/* Returns the free-list link of OBJ in cache C. */
+static inline void **
+obj_link (const struct kmem_cache *c, void *obj)
+{
+  return (void **) ((uint8_t *) obj + c->link_ofs);
+}
+
+/* Creates and returns a cache of SIZE-byte objects named NAME.
+   If CTOR is non-null, it is run on each object when its slab is
+   created. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, kmem_ctor_func *ctor)
+{
+  struct kmem_cache *c;
+
+  ASSERT (name != NULL);
+  ASSERT (size > 0);
+  ASSERT (cache_cnt < sizeof caches / sizeof *caches);
+
+  c = &caches[cache_cnt++];
+  c->name = name;
+  c->obj_size = size;
+  c->ctor = ctor;
+  if (ctor != NULL)
+    {
+      c->link_ofs = ROUND_UP (size, sizeof (void *));
+      c->stride = c->link_ofs + sizeof (void *);
+    }
+  else
+    {
+      c->link_ofs = 0;
+      c->stride = ROUND_UP (size < sizeof (void *) ? sizeof (void *) : size,
+                            sizeof (void *));
+    }
+  c->objs_per_slab = (PGSIZE - sizeof (struct slab)) / c->stride;
+  ASSERT (c->objs_per_slab > 0);
+  list_init (&c->partial);
+  lock_init (&c->lock);
+  c->slab_cnt = c->in_use = c->peak = 0;
+  c->allocs = c->frees = 0;
+  return c;
+}
+
+/* Adds a new slab to cache C.  Returns false if memory is not
+   available. */
+static bool
+grow_cache (struct kmem_cache *c)
+{
+  struct slab *s;
+  size_t i;
+
+  s = palloc_get_page (0);
+  if (s == NULL)
+    return false;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->free_cnt = c->objs_per_slab;
+  s->free = NULL;
+  for (i = c->objs_per_slab; i-- > 0; )
+    {
+      void *obj = (uint8_t *) (s + 1) + i * c->stride;
+      if (c->ctor != NULL)
+        c->ctor (obj);
+      *obj_link (c, obj) = s->free;
+      s->free = obj;
+    }
+  list_push_front (&c->partial, &s->elem);
+  c->slab_cnt++;
+  return true;
+}
+
+/* Obtains and returns an object from cache C.  Returns a null
+   pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  ASSERT (c != NULL);
+
+  lock_acquire (&c->lock);
+  if (list_empty (&c->partial) && !grow_cache (c))
+    {
+      lock_release (&c->lock);
+      return NULL;
+    }
+
+  s = list_entry (list_front (&c->partial), struct slab, elem);
+  obj = s->free;
+  s->free = *obj_link (c, obj);
+  if (--s->free_cnt == 0)
+    list_remove (&s->elem);
+
+  c->allocs++;
+  if (++c->in_use > c->peak)
+    c->peak = c->in_use;
+  lock_release (&c->lock);
+  return obj;
+}
+
+/* Returns OBJ, which must have been allocated from cache C, to
+   C. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+
+  ASSERT (c != NULL);
+  if (obj == NULL)
+    return;
+
+  s = obj_to_slab (obj);
+  ASSERT (s->cache == c);
+
+#ifndef NDEBUG
+  /* Clear the object to help detect use-after-free bugs, unless
+     it must stay constructed. */
+  if (c->ctor == NULL)
+    memset (obj, 0xcc, c->obj_size);
+#endif
+
+  lock_acquire (&c->lock);
+  *obj_link (c, obj) = s->free;
+  s->free = obj;
+  if (s->free_cnt++ == 0)
+    list_push_front (&c->partial, &s->elem);
+
+  /* Give an entirely free slab back, unless it is all we have. */
+  if (s->free_cnt == c->objs_per_slab
+      && list_front (&c->partial) != list_back (&c->partial))
+    {
+      list_remove (&s->elem);
+      c->slab_cnt--;
+      palloc_free_page (s);
+    }
+
+  c->frees++;
+  c->in_use--;
+  lock_release (&c->lock);
+}
+
+/* Prints statistics for each cache. */
+void
+slab_print_stats (void)
+{
+  size_t i;
+
+  printf ("Slab: cache              size  per slab  slabs  in use   peak"
+          "     allocs      frees\n");
+  for (i = 0; i < cache_cnt; i++)
+    {
+      struct kmem_cache *c = &caches[i];
+      printf ("Slab: %-16s %6zu %9zu %6zu %7zu %6zu %10lld %10lld\n",
+              c->name, c->obj_size, c->objs_per_slab, c->slab_cnt,
+              c->in_use, c->peak, c->allocs, c->frees);
+    }
+}
+
+/* Returns the slab that OBJ is inside. */
+static struct slab *
+obj_to_slab (void *obj)
+{
+  struct slab *s = pg_round_down (obj);
+
+  /* Check that the slab is valid. */
+  ASSERT (s != NULL);
+  ASSERT (s->magic == SLAB_MAGIC);
+
+  /* Check that the object is properly aligned for the slab. */
+  ASSERT ((pg_ofs (obj) - sizeof *s) % s->cache->stride == 0);
+
+  return s;
+}
@@ -121,10 +121,12 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
 	if (!list_empty (&sema->waiters)) {
-		/* Task 2. priority may change due to donation. */
-		list_sort(&sema->waiters, list_less_thread_priority, NULL);
-		thread_unblock (list_entry (list_pop_front (&sema->waiters),
-		                            struct thread, elem));
+		/* Task 2. priority may change due to donation, so pick the
+		 * highest-priority waiter (first one among equals) instead of
+		 * keeping the list sorted. */
+		struct list_elem *e = list_min (&sema->waiters, list_less_thread_priority, NULL);
+		list_remove (e);
+		thread_unblock (list_entry (e, struct thread, elem));
 	}
 	sema->value++;
 	intr_set_level (old_level);
@@ -133,12 +135,8 @@ sema_up (struct semaphore *sema)
 	 * cannot yield here, cause kernel panic during booting.
 	 * Since lock-release and sema-up both may create threads with higher priority,
 	 * yield in sema. */
-	if (thread_start_flag)  {
-		if (intr_context())
-			intr_yield_on_return();
-		else
-			thread_yield();
-	}
+	if (thread_start_flag)
+		thread_preempt ();
 }
 
 static void sema_test_helper (void *sema_);
@@ -178,6 +176,8 @@ sema_test_helper (void *sema_)
     }
 }
 
+static int held_donation (struct thread *);
+
 /* Initializes LOCK.  A lock can be held by at most a single
    thread at any given time.  Our locks are not "recursive", that
    is, it is an error for the thread currently holding a lock to
@@ -200,6 +200,8 @@ lock_init (struct lock *lock)
 
   lock->holder = NULL;
   sema_init (&lock->semaphore, 1);
+  lock->max_priority = PRI_MIN;
+  lock->donating = false;
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
@@ -213,33 +215,35 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   if (!thread_mlfqs) {
 	  /* Task 2. */
+	  struct thread *cur = thread_current();
 	  if (!lock_try_acquire(lock)) {
 		  // wait for lock, boost locker's priority, recursively.
-		  thread_current()->lock_waiting = lock;
-		  lock_priority_nested_donation(thread_current());
+		  cur->lock_waiting = lock;
+		  lock_priority_nested_donation(cur);
 
 		  sema_down(&lock->semaphore);
 
-		  thread_current()->lock_waiting = NULL;
-		  lock->holder = thread_current ();
+		  cur->lock_waiting = NULL;
+		  lock->holder = cur;
+		  // boost self's priority using locks' remaining waiters.
+		  if (!list_empty(&lock->semaphore.waiters))
+			  lock_acquired_donation(lock);
 	  }
-	  // manage to acquire lock. boost self's priority using locks' waiters.
-	  list_push_back(&thread_current()->locks_acquired, &lock->elem);
-	  struct thread *cur = thread_current();
-	  int donate = lock_waiters_donation(lock);
-	  cur->donate_priority = MAX (cur->donate_priority, donate);
-	  cur->priority = MAX (cur->priority, cur->donate_priority);
   }
   else {
 	  sema_down(&lock->semaphore);
 	  lock->holder = thread_current ();
   }
+  intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -251,14 +255,24 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      lock->holder = thread_current ();
+      /* Task 2. Fast path: if nobody else wants the lock, it donates
+         nothing and needs no bookkeeping.  Otherwise we took it ahead
+         of woken waiters and must take their donation. */
+      if (!thread_mlfqs && !list_empty (&lock->semaphore.waiters))
+        lock_acquired_donation (lock);
+    }
+  intr_set_level (old_level);
   return success;
 }
 
@@ -270,24 +284,26 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock) 
 {
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
-  if (!thread_mlfqs) {
-	  /* Task 2*/
-	  ASSERT(thread_current() == lock->holder);
+  old_level = intr_disable ();
+  if (!thread_mlfqs && lock->donating) {
+	  /* Task 2. Only a lock that had waiters can have donated to us.
+	   * recalculate this thread's priority from the locks still held */
 	  struct thread *cur = thread_current();
 	  list_remove(&lock->elem);
-	  // recalculate this thread's priority
-	  cur->priority = cur->base_priority;
-	  cur->donate_priority = 0;
+	  lock->donating = false;
+	  lock->max_priority = PRI_MIN;
 
-	  cur->donate_priority = MAX (cur->donate_priority, locks_list_donation(&cur->locks_acquired));
+	  cur->donate_priority = held_donation(cur);
 	  cur->priority = MAX (cur->base_priority, cur->donate_priority);
   }
   lock->holder = NULL;
   sema_up(&lock->semaphore);
-
+  intr_set_level (old_level);
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -302,6 +318,131 @@ lock_held_by_current_thread (const struct lock *lock)
 }
 
 
+/* Initializes RWLOCK.  A reader-writer lock can be held by any
+   number of readers at once, or by a single writer.  A thread
+   may hold at most one reader-writer lock for reading at a time,
+   and neither mode is recursive.
+
+   Writers are preferred: a writer takes RWLOCK's inner lock and
+   keeps it while it waits for the current readers to leave, so
+   readers that arrive after it wait on the inner lock until it is
+   done.  Threads waiting on the inner lock donate to the writer
+   through the usual lock donation, and a waiting writer donates
+   its priority to each reader. */
+void
+rwlock_init (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_init (&rwlock->lock);
+  rwlock->readers = 0;
+  list_init (&rwlock->reader_list);
+  sema_init (&rwlock->drained, 0);
+  rwlock->writer_waiting = false;
+  rwlock->max_priority = PRI_MIN;
+}
+
+/* Acquires RWLOCK for reading, sleeping while a writer holds it
+   or is waiting for it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_shared (struct rwlock *rwlock)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (cur->rwlock_reading == NULL);
+
+  lock_acquire (&rwlock->lock);
+  old_level = intr_disable ();
+  rwlock->readers++;
+  list_push_back (&rwlock->reader_list, &cur->rwlock_elem);
+  cur->rwlock_reading = rwlock;
+  intr_set_level (old_level);
+  lock_release (&rwlock->lock);
+}
+
+/* Acquires RWLOCK for writing, sleeping until no other thread
+   holds it in either mode.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_exclusive (struct rwlock *rwlock)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (cur->rwlock_reading != rwlock);
+
+  lock_acquire (&rwlock->lock);
+  old_level = intr_disable ();
+  if (rwlock->readers > 0)
+    {
+      rwlock->writer_waiting = true;
+      if (!thread_mlfqs)
+        {
+          cur->rwlock_draining = rwlock;
+          rwlock_readers_donation (rwlock, cur->priority);
+        }
+      sema_down (&rwlock->drained);
+      cur->rwlock_draining = NULL;
+      rwlock->writer_waiting = false;
+      rwlock->max_priority = PRI_MIN;
+    }
+  intr_set_level (old_level);
+}
+
+/* Releases RWLOCK, which the current thread must hold in either
+   mode. */
+void
+rwlock_release (struct rwlock *rwlock)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (rwlock != NULL);
+  ASSERT (rwlock_held_by_current_thread (rwlock));
+
+  if (lock_held_by_current_thread (&rwlock->lock))
+    {
+      lock_release (&rwlock->lock);
+      return;
+    }
+
+  old_level = intr_disable ();
+  list_remove (&cur->rwlock_elem);
+  cur->rwlock_reading = NULL;
+  if (!thread_mlfqs && cur->donate_priority > PRI_MIN)
+    {
+      /* Task 2. Drop the waiting writer's donation. */
+      cur->donate_priority = held_donation (cur);
+      cur->priority = MAX (cur->base_priority, cur->donate_priority);
+    }
+  if (--rwlock->readers == 0 && rwlock->writer_waiting)
+    sema_up (&rwlock->drained);
+  else if (thread_start_flag)
+    thread_preempt ();
+  intr_set_level (old_level);
+}
+
+/* Returns true if the current thread holds RWLOCK in either
+   mode, false otherwise. */
+bool
+rwlock_held_by_current_thread (const struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  return (lock_held_by_current_thread (&rwlock->lock)
+          || thread_current ()->rwlock_reading == rwlock);
+}
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -336,24 +477,45 @@ cond_init (struct condition *cond)
 void
 cond_wait (struct condition *cond, struct lock *lock) 
 {
-  struct semaphore_elem waiter;
+  struct cond_waiter waiter;
+  enum intr_level old_level;
 
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
-	/* Task 2. */
-	waiter.wait_thread = thread_current();
+  waiter.thread = thread_current ();
+  waiter.signaled = false;
 
-  sema_init (&waiter.semaphore, 0);
+  /* Queue up before releasing LOCK so that no signal sent after
+     that can be missed.  Releasing LOCK may yield, leaving us
+     ready rather than blocked when the signal comes, so block
+     only if it has not come yet. */
+  old_level = intr_disable ();
   list_push_back (&cond->waiters, &waiter.elem);
   lock_release (lock);
-  sema_down (&waiter.semaphore);
+  if (!waiter.signaled)
+    thread_block ();
+  intr_set_level (old_level);
 
   lock_acquire (lock);
 }
 
+/* Takes WAITER off its condition variable's wait queue and wakes
+   its thread, if it has gone to sleep yet.  Interrupts must be
+   off. */
+static void
+cond_wake (struct cond_waiter *waiter)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_remove (&waiter->elem);
+  waiter->signaled = true;
+  if (waiter->thread->status == THREAD_BLOCKED)
+    thread_unblock (waiter->thread);
+}
+
 /* If any threads are waiting on COND (protected by LOCK), then
    this function signals one of them to wake up from its wait.
    LOCK must be held before calling this function.
@@ -364,17 +526,26 @@ cond_wait (struct condition *cond, struct lock *lock)
 void
 cond_signal (struct condition *cond, struct lock *lock UNUSED) 
 {
+  enum intr_level old_level;
+
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
-  if (!list_empty (&cond->waiters)) {
-	  /* Task 2. priority may change due to donation. */
-		list_sort(&cond->waiters, list_less_cond_waiter_priority, NULL);
-	  sema_up (&list_entry (list_pop_front (&cond->waiters),
-	                        struct semaphore_elem, elem)->semaphore);
-  }
+  if (list_empty (&cond->waiters))
+    return;
+
+  /* Task 2. priority may change due to donation, so pick the
+   * highest-priority waiter instead of keeping the queue sorted. */
+  old_level = intr_disable ();
+  cond_wake (list_entry (list_min (&cond->waiters,
+                                   list_less_cond_waiter_priority, NULL),
+                         struct cond_waiter, elem));
+  intr_set_level (old_level);
+
+  if (thread_start_flag)
+    thread_preempt ();
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -386,59 +557,136 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
 void
 cond_broadcast (struct condition *cond, struct lock *lock) 
 {
+  enum intr_level old_level;
+
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (lock_held_by_current_thread (lock));
+
+  if (list_empty (&cond->waiters))
+    return;
 
+  /* The ready queue puts the woken threads in priority order. */
+  old_level = intr_disable ();
   while (!list_empty (&cond->waiters))
-    cond_signal (cond, lock);
-}
+    cond_wake (list_entry (list_front (&cond->waiters),
+                           struct cond_waiter, elem));
+  intr_set_level (old_level);
 
+  if (thread_start_flag)
+    thread_preempt ();
+}
 
 /* Task 2. Priority scheduling.
  * Boost holder's priority with waiter's. Do it iteratively until holder is no longer
- * a waiter for other locks. */
+ * a waiter for other locks.  Each lock on the way records the highest priority
+ * waiting for it, and is put on its holder's locks_acquired the first time it
+ * has a waiter. */
 void
 lock_priority_nested_donation (struct thread *waiter) {
-	struct thread *holder = waiter->lock_waiting->holder;
+	struct lock *lock = waiter->lock_waiting;
 	while (1) {
-		holder->donate_priority = MAX (holder->donate_priority, waiter->priority);
-		holder->priority = MAX (holder->priority, holder->donate_priority);
+		struct thread *holder = lock->holder;
+		lock->max_priority = MAX (lock->max_priority, waiter->priority);
+		if (!lock->donating) {
+			list_push_back(&holder->locks_acquired, &lock->elem);
+			lock->donating = true;
+		}
 
-		if (holder->lock_waiting == NULL) return;
+		holder->donate_priority = MAX (holder->donate_priority, lock->max_priority);
+		thread_update_priority (holder, MAX (holder->priority, holder->donate_priority));
+
+		if (holder->lock_waiting == NULL) {
+			/* A writer waiting for readers passes the donation on. */
+			if (holder->rwlock_draining != NULL)
+				rwlock_readers_donation(holder->rwlock_draining, holder->priority);
+			return;
+		}
 
 		waiter = holder;
-		holder = holder->lock_waiting->holder;
+		lock = holder->lock_waiting;
+	}
+}
+
+/* Task 2. Priority scheduling.
+ * Boost every reader of RWLOCK to at least PRIORITY, and whatever each of
+ * them is waiting for in turn.  Called with interrupts off on behalf of the
+ * writer waiting for the readers to leave. */
+void
+rwlock_readers_donation (struct rwlock *rwlock, int priority) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (priority <= rwlock->max_priority) return;
+	rwlock->max_priority = priority;
+	for (struct list_elem *e = list_begin(&rwlock->reader_list);
+	     e != list_end(&rwlock->reader_list); e = list_next(e)) {
+		struct thread *reader = list_entry(e, struct thread, rwlock_elem);
+		reader->donate_priority = MAX (reader->donate_priority, priority);
+		thread_update_priority (reader, MAX (reader->priority, reader->donate_priority));
+		if (reader->lock_waiting != NULL)
+			lock_priority_nested_donation(reader);
+	}
+}
+
+/* Task 2. Priority scheduling.
+ * Called with interrupts off by the new holder of LOCK when threads are still
+ * waiting for it.  Recomputes the lock's highest waiter priority, which may
+ * have dropped with the waiter that just left, and takes the donation. */
+void
+lock_acquired_donation (struct lock *lock) {
+	struct thread *cur = lock->holder;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	lock->max_priority = lock_waiters_donation(lock);
+	if (!lock->donating) {
+		list_push_back(&cur->locks_acquired, &lock->elem);
+		lock->donating = true;
 	}
+	cur->donate_priority = MAX (cur->donate_priority, lock->max_priority);
+	cur->priority = MAX (cur->priority, cur->donate_priority);
 }
 
 /* Task 2. Priority scheduling.
- * Calculate maximum effective donation made by a lock's waiters.
- * Return minimum priority if no waiter present. */
+ * Calculate maximum effective donation made by a lock's waiters, in a single
+ * pass over them.  Return minimum priority if no waiter present. */
 int
 lock_waiters_donation (struct lock *lock) {
 	if (list_empty(&lock->semaphore.waiters))
 		return PRI_MIN;
-	list_sort(&lock->semaphore.waiters, list_less_thread_priority, NULL);
-	return list_entry(list_front(&lock->semaphore.waiters), struct thread, elem)->priority;
+	return list_entry(list_min(&lock->semaphore.waiters, list_less_thread_priority, NULL),
+	                  struct thread, elem)->priority;
 }
 
 /* Task 2. Priority scheduling.
- * Utility for getting donation from a list of locks. */
+ * Utility for getting donation from a list of locks, using each lock's
+ * recorded highest waiter priority. */
 int
 locks_list_donation (struct list *locks) {
 	int tot_donate = PRI_MIN;
-	if (!list_empty(locks))
-		for (struct list_elem *e = list_begin(locks); e != list_end(locks); e = e->next) {
-			struct lock *lock_acq = list_entry(e, struct lock, elem);
-			tot_donate = MAX (tot_donate, lock_waiters_donation(lock_acq));
-		}
+	for (struct list_elem *e = list_begin(locks); e != list_end(locks); e = list_next(e)) {
+		struct lock *lock_acq = list_entry(e, struct lock, elem);
+		tot_donate = MAX (tot_donate, lock_acq->max_priority);
+	}
 	return tot_donate;
 }
 
+/* Task 2. Priority scheduling.
+ * Total donation to T from the locks it holds and, if it is reading
+ * a reader-writer lock, from the writer waiting for it. */
+static int
+held_donation (struct thread *t) {
+	int donate = locks_list_donation(&t->locks_acquired);
+	if (t->rwlock_reading != NULL)
+		donate = MAX (donate, t->rwlock_reading->max_priority);
+	return donate;
+}
+
 /* Task 2. condition variable waiter sort cmp */
 bool list_less_cond_waiter_priority (const struct list_elem *a,
                                      const struct list_elem *b,
                                      void *aux) {
-	return list_entry(a, struct semaphore_elem, elem)->wait_thread->priority >
-				 list_entry(b, struct semaphore_elem, elem)->wait_thread->priority;
+	return list_entry(a, struct cond_waiter, elem)->thread->priority >
+				 list_entry(b, struct cond_waiter, elem)->thread->priority;
 }
\ No newline at end of file
@@ -22,7 +22,10 @@ struct lock
   {
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
-    struct list_elem elem; /* Task 2. */
+    /* Task 2. */
+    struct list_elem elem;      /* Element in holder's locks_acquired. */
+    int max_priority;           /* Highest priority waiting, if donating. */
+    bool donating;              /* In holder's locks_acquired? */
   };
 
 void lock_init (struct lock *);
@@ -31,6 +34,28 @@ bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
 
+/* Reader-writer lock.  Any number of readers may hold it at
+   once, or a single writer.  A writer that arrives holds LOCK
+   while it waits for the readers to drain, so later readers queue
+   up behind it (writer preference) and donate to it like any
+   other lock waiter. */
+struct rwlock
+  {
+    struct lock lock;           /* Held by the writer; by readers only
+                                   while they enter. */
+    int readers;                /* Number of threads reading. */
+    struct list reader_list;    /* Reading threads, for donation. */
+    struct semaphore drained;   /* Upped by the last reader out. */
+    bool writer_waiting;        /* Writer waiting on DRAINED? */
+    int max_priority;           /* Priority donated to the readers. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_shared (struct rwlock *);
+void rwlock_acquire_exclusive (struct rwlock *);
+void rwlock_release (struct rwlock *);
+bool rwlock_held_by_current_thread (const struct rwlock *);
+
 /* Condition variable. */
 struct condition 
   {
@@ -44,6 +69,8 @@ void cond_broadcast (struct condition *, struct lock *);
 
 /* Task 2. Priority scheduling. */
 void lock_priority_nested_donation (struct thread *);
+void lock_acquired_donation (struct lock *);
+void rwlock_readers_donation (struct rwlock *, int priority);
 int lock_waiters_donation (struct lock *);
 int locks_list_donation (struct list *);
 /* Task 2. condition variable waiter sort cmp */
@@ -51,15 +78,13 @@ bool list_less_cond_waiter_priority (const struct list_elem *a,
                                       const struct list_elem *b,
                                       void *aux);
 
-/* One semaphore in a list.
- * Used exclusively for condition variable. */
-struct semaphore_elem
+/* A thread waiting on a condition variable.  Lives on the
+ * waiting thread's stack for the duration of cond_wait(). */
+struct cond_waiter
 {
-	struct list_elem elem;              /* List element. */
-	struct semaphore semaphore;         /* This semaphore. */
-	/* Task 2. thread waiting for the condition variable via this semaphore
-	 * wake up wait_thread with highest priority during cond_signal */
-	struct thread *wait_thread;
+	struct list_elem elem;              /* Element in the condition's waiters. */
+	struct thread *thread;              /* Waiting thread. */
+	bool signaled;                      /* Taken off the waiters by a signal? */
 };
 
 /* Optimization barrier.
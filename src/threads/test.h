@@ -0,0 +1,7 @@
+#ifndef THREADS_TEST_H
+#define THREADS_TEST_H
+
+/* Entry point of a test program in tests/internal. */
+void test (void);
+
+#endif /* threads/test.h */
@@ -14,6 +14,7 @@
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "malloc.h"
@@ -27,13 +28,14 @@
 #define MAX(a,b)  (((a)>(b))?(a):(b))
 #define MIN(a,b)  (((a)<(b))?(a):(b))
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
-
-/* Task 3 */
-struct list ready_lists[PRI_MAX + 1];
-
+/* Lists of processes in THREAD_READY state, that is, processes
+   that are ready to run but not actually running, one FIFO list
+   per priority.  Bit P of ready_bitmap is set iff ready_lists[P]
+   is non-empty, so enqueue, dequeue and finding the highest ready
+   priority are all O(1) for both schedulers. */
+static struct list ready_lists[PRI_MAX + 1];
+static uint64_t ready_bitmap;
+static int ready_cnt;           /* # of threads in ready_lists. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -60,6 +62,19 @@ struct kernel_thread_frame
 static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
+static long long voluntary_switches;   /* # of switches away from a
+                                          blocked or dying thread. */
+static long long involuntary_switches; /* # of switches away from a
+                                          thread still ready to run. */
+static long long yields;        /* # of calls to thread_yield(). */
+static long long null_yields;   /* # of those that kept running. */
+
+/* Log-scale histogram of wakeup-to-run latency, the time from
+   thread_unblock() until the thread next runs.  Bucket I counts
+   latencies in [2**I, 2**(I+1)) ns; the last bucket also counts
+   everything longer. */
+#define LATENCY_BUCKETS 40
+static long long wakeup_latency[LATENCY_BUCKETS];
 
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
@@ -72,6 +87,18 @@ bool thread_mlfqs;
 /* Task 3 */
 fixed_t load_avg;
 
+/* Task 3. recent_cpu is decayed lazily.  Instead of sweeping every
+   thread once per second, the decay coefficient of each second is
+   recorded in decay_table, and a thread's recent_cpu is brought up
+   to date from its own recent_cpu_seconds stamp whenever the thread
+   is next looked at.  The table only needs to cover the longest a
+   thread can go unexamined: MLFQS_REFRESH_BATCH threads are also
+   refreshed on every tick. */
+#define DECAY_HISTORY 64
+#define MLFQS_REFRESH_BATCH 8
+static fixed_t decay_table[DECAY_HISTORY];
+static int64_t mlfqs_seconds;   /* # of decays recorded so far. */
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
@@ -83,6 +110,12 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static void ready_push (struct thread *);
+static struct thread *ready_pop (void);
+static void ready_remove (struct thread *);
+static int ready_highest (void);
+static int mlfqs_priority (struct thread *);
+static void thread_print_one_stats (struct thread *, void *aux);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -103,11 +136,11 @@ thread_init (void)
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
   list_init (&all_list);
-  /* Task 3 */
   for (int i = PRI_MIN; i <= PRI_MAX; ++i)
       list_init(ready_lists + i);
+  ready_bitmap = 0;
+  ready_cnt = 0;
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
@@ -153,22 +186,58 @@ thread_tick (void)
     idle_ticks++;
 #ifdef USERPROG
   else if (t->pagedir != NULL)
-    user_ticks++;
+    {
+      user_ticks++;
+      t->user_ticks++;
+    }
 #endif
   else
-		kernel_ticks++;
+    {
+      kernel_ticks++;
+      t->kernel_ticks++;
+    }
 
 	/* Enforce preemption. */
 	if (++thread_ticks >= TIME_SLICE)
 		intr_yield_on_return();
 }
 
-/* Prints thread statistics. */
+/* Prints thread statistics: global tick counts, context switches,
+   per-thread accounting for every live thread, and the
+   wakeup-to-run latency histogram. */
 void
 thread_print_stats (void)
 {
+	enum intr_level old_level;
+	int i;
+
 	printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
 	        idle_ticks, kernel_ticks, user_ticks);
+	printf ("Thread: %lld context switches, %lld voluntary, %lld involuntary\n",
+	        voluntary_switches + involuntary_switches,
+	        voluntary_switches, involuntary_switches);
+	printf ("Thread: %lld yields, %lld without a switch\n",
+	        yields, null_yields);
+
+	printf ("Thread: tid name             user kernel    vol  invol  ready(us)\n");
+	old_level = intr_disable ();
+	thread_foreach (thread_print_one_stats, NULL);
+	intr_set_level (old_level);
+
+	printf ("Thread: wakeup-to-run latency\n");
+	for (i = 0; i < LATENCY_BUCKETS; i++)
+		if (wakeup_latency[i] != 0)
+			printf ("  >= %'14llu ns: %lld\n", 1ULL << i, wakeup_latency[i]);
+}
+
+/* Prints the accounting for thread T, one line. */
+static void
+thread_print_one_stats (struct thread *t, void *aux UNUSED)
+{
+	printf ("Thread: %3d %-16s %4lld %6lld %6lld %6lld %10llu\n",
+	        t->tid, t->name, t->user_ticks, t->kernel_ticks,
+	        t->voluntary_switches, t->involuntary_switches,
+	        t->ready_ns / 1000);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -207,8 +276,8 @@ thread_create (const char *name, int priority,
   init_thread (t, name, priority);
 
   /* Task 1
-      Initialize task 1's snap_ticks to be 0, not in sleep state */
-  t->snap_ticks = 0;
+      Initialize task 1's wakeup_tick to be 0, not in sleep state */
+  t->wakeup_tick = 0;
   /* Task 2 */
   t->base_priority = priority;
   t->donate_priority = PRI_MIN;
@@ -218,6 +287,7 @@ thread_create (const char *name, int priority,
    * new thread's nice and recent_cpu are inherited from parent */
   t->nice = thread_current()->nice;
   t->recent_cpu = thread_current()->recent_cpu;
+  t->recent_cpu_seconds = thread_current()->recent_cpu_seconds;
 
   tid = t->tid = allocate_tid ();
 
@@ -250,7 +320,7 @@ thread_create (const char *name, int priority,
   /* Add to run queue. */
   thread_unblock (t);
 
-  thread_yield();
+  thread_preempt ();
 
   return tid;
 }
@@ -288,12 +358,17 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-	if (!thread_mlfqs)
-		/* Task 2 */
-    list_insert_ordered(&ready_list, &t->elem, list_less_thread_priority, NULL);
-	else
-		/* Task 3 */
-		list_push_back(ready_lists + t->priority, &t->elem);
+  /* Task 3. T's priority is stale if it blocked before the last
+     second boundary. */
+  if (thread_mlfqs && t->recent_cpu_seconds != mlfqs_seconds)
+    {
+      thread_recent_cpu_update (t, NULL);
+      t->priority = mlfqs_priority (t);
+    }
+  /* Task 2. Task 3. */
+  ready_push (t);
+  t->ready_since = timer_now_ns ();
+  t->woken = true;
 
   t->status = THREAD_READY;
   intr_set_level (old_level);
@@ -366,20 +441,38 @@ thread_yield (void)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  if (cur != idle_thread) {
-	  if (!thread_mlfqs)
-		  /* Task 2 */
-		  list_insert_ordered(&ready_list, &cur->elem, list_less_thread_priority, NULL);
-	  else
-		  /* Task 3 */
-		  list_push_back(ready_lists + cur->priority, &cur->elem);
-  }
+  yields++;
+  if (cur != idle_thread)
+    {
+      /* Task 2. Task 3. */
+      ready_push (cur);
+      cur->ready_since = timer_now_ns ();
+    }
 
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
 }
 
+/* Yields the CPU if a ready thread outranks the current one.
+   Within an interrupt handler, yields on return from it
+   instead. */
+void
+thread_preempt (void)
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (thread_current ()->priority < thread_highest_ready_priority ())
+    {
+      if (intr_context ())
+        intr_yield_on_return ();
+      else
+        thread_yield ();
+    }
+  intr_set_level (old_level);
+}
+
 /* Invoke function 'func' on all threads, passing along 'aux'.
    This function must be called with interrupts off. */
 void
@@ -405,7 +498,7 @@ thread_set_priority (int new_priority)
 
 	thread_current()->base_priority = new_priority;
   thread_current ()->priority = MAX (thread_current()->base_priority, thread_current()->donate_priority);
-  thread_yield ();
+  thread_preempt ();
 }
 
 /* Returns the current thread's priority. */
@@ -424,8 +517,7 @@ thread_set_nice (int nice UNUSED)
   thread_current()->nice = nice;
   thread_priority_update(thread_current(), NULL);
 
-//  if (thread_current()->priority < thread_highest_ready_priority())
-  	thread_yield();
+  thread_preempt ();
 }
 
 /* Returns the current thread's nice value. */
@@ -474,6 +566,20 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Nothing else is ready, so zero free pages ahead of
+         PAL_ZERO requests until something is.  Don't halt if
+         that let a thread become ready. */
+      intr_enable ();
+      while (ready_bitmap == 0 && palloc_zero_page ())
+        continue;
+      intr_disable ();
+      if (ready_bitmap != 0)
+        continue;
+
+      /* Nothing else is ready to run, so don't take another
+         timer interrupt until a sleeper is due. */
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -539,9 +645,12 @@ init_thread (struct thread *t, const char *name, int priority)
 	t->donate_priority = PRI_MIN;
 	list_init(&t->locks_acquired);
 	t->lock_waiting = NULL;
+	t->rwlock_reading = NULL;
+	t->rwlock_draining = NULL;
 	/* Task 3. initial thread's nice and recent_cpu are set to 0. */
 	t->nice = 0;
 	t->recent_cpu = FIXED(0);
+	t->recent_cpu_seconds = mlfqs_seconds;
 
 	t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
@@ -575,21 +684,25 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-	if (!thread_mlfqs) {
-		if (list_empty (&ready_list))
-			return idle_thread;
-		else
-			return list_entry (list_pop_front (&ready_list), struct thread, elem);
-	}
-	else {
-		/* Task 3. schedule round-robin for highest-priority-non-empty queue */
-		for (int i = PRI_MAX; i >= PRI_MIN; --i) {
-			if (!list_empty(ready_lists + i)) {
-				return list_entry(list_pop_front(ready_lists + i), struct thread, elem);
-			}
-		}
+	/* Task 2. Task 3. schedule round-robin for highest-priority-non-empty queue */
+	if (ready_bitmap == 0)
 		return idle_thread;
+
+	struct thread *t = ready_pop ();
+
+	/* Task 3. T may have been sitting in its queue with a priority from
+	 * before the last second boundary.  Bring it up to date, and put it
+	 * back if that makes it lose to another ready thread.  Each thread
+	 * is refreshed at most once per second, so this terminates. */
+	while (thread_mlfqs && t->recent_cpu_seconds != mlfqs_seconds) {
+		thread_recent_cpu_update (t, NULL);
+		t->priority = mlfqs_priority (t);
+		if (ready_bitmap == 0 || t->priority >= ready_highest ())
+			break;
+		ready_push (t);
+		t = ready_pop ();
 	}
+	return t;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -618,6 +731,19 @@ thread_schedule_tail (struct thread *prev)
   /* Mark us as running. */
   cur->status = THREAD_RUNNING;
 
+  /* Account the time we spent in the ready queue. */
+  if (cur != idle_thread)
+    {
+      uint64_t waited = timer_now_ns () - cur->ready_since;
+      cur->ready_ns += waited;
+      if (cur->woken)
+        {
+          int bucket = waited == 0 ? 0 : 63 - __builtin_clzll (waited);
+          wakeup_latency[MIN (bucket, LATENCY_BUCKETS - 1)]++;
+          cur->woken = false;
+        }
+    }
+
   /* Start new time slice. */
   thread_ticks = 0;
 
@@ -660,7 +786,21 @@ schedule (void)
 
 
 	if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      if (cur->status == THREAD_READY)
+        {
+          cur->involuntary_switches++;
+          involuntary_switches++;
+        }
+      else
+        {
+          cur->voluntary_switches++;
+          voluntary_switches++;
+        }
+      prev = switch_threads (cur, next);
+    }
+  else
+    null_yields++;
   thread_schedule_tail (prev);
 }
 
@@ -683,22 +823,6 @@ allocate_tid (void)
 uint32_t thread_stack_ofs = offsetof (struct thread, stack);
 
 
-/* Task 1 -- thread_action_func for thread_foreach in thread.h */
-void
-thread_sleep_check (struct thread *t, void *aux UNUSED) {
-	// interruption should be turned down during thread_foreach.
-	ASSERT(intr_get_level () == INTR_OFF);
-
-	if (t->snap_ticks == 0)
-		return;
-
-	t->snap_ticks --;
-	if (t->snap_ticks == 0) {
-		ASSERT (t->status == THREAD_BLOCKED);
-		thread_unblock(t);
-	}
-}
-
 /* Task 2 */
 bool
 list_less_thread_priority (const struct list_elem *a,
@@ -710,28 +834,60 @@ list_less_thread_priority (const struct list_elem *a,
 	       list_entry (b, struct thread, elem)->priority;
 }
 
-/* Task 3 */
+/* Task 3. Applies the decays recorded since T's recent_cpu was
+ * last brought up to date.  A thread unexamined for longer than
+ * DECAY_HISTORY seconds reuses the oldest recorded coefficient for
+ * the seconds that fell out of the table. */
 void
 thread_recent_cpu_update (struct thread *t, void *aux UNUSED) {
 	ASSERT(thread_mlfqs);
-	ASSERT(intr_context());
+	ASSERT(intr_get_level () == INTR_OFF);
 
-	t->recent_cpu = FADD_INT(
-		FMUL(
-			FDIV(
-				FMUL_INT(load_avg, 2), FADD_INT(FMUL_INT(load_avg, 2), 1)),
-			t->recent_cpu),
-		t->nice);
+	int64_t sec = t->recent_cpu_seconds;
+	if (mlfqs_seconds - sec > DECAY_HISTORY) {
+		fixed_t oldest = decay_table[mlfqs_seconds % DECAY_HISTORY];
+		for (; sec < mlfqs_seconds - DECAY_HISTORY; ++sec)
+			t->recent_cpu = FADD_INT(FMUL(oldest, t->recent_cpu), t->nice);
+	}
+	for (; sec < mlfqs_seconds; ++sec)
+		t->recent_cpu = FADD_INT(
+			FMUL(decay_table[sec % DECAY_HISTORY], t->recent_cpu), t->nice);
+	t->recent_cpu_seconds = mlfqs_seconds;
 }
 
-/* Task 3 */
+/* Task 3. Brings T's recent_cpu up to date and recomputes its
+ * priority, moving it between ready_lists only if that changes. */
 void
-thread_priority_update (struct thread *t, void *aux) {
+thread_priority_update (struct thread *t, void *aux UNUSED) {
   ASSERT(thread_mlfqs);
 
   if (t == idle_thread)
       return ;
 
+  enum intr_level old_level = intr_disable ();
+  thread_recent_cpu_update (t, NULL);
+  thread_update_priority (t, mlfqs_priority (t));
+  intr_set_level (old_level);
+}
+
+/* Task 3. Refreshes the priority of the MLFQS_REFRESH_BATCH threads
+ * at the front of all_list and rotates them to the back, so every
+ * thread is looked at regularly at a constant cost per tick. */
+void
+thread_mlfqs_refresh (void) {
+	ASSERT(thread_mlfqs);
+	ASSERT(intr_get_level () == INTR_OFF);
+
+	for (int i = 0; i < MLFQS_REFRESH_BATCH; ++i) {
+		struct list_elem *e = list_pop_front (&all_list);
+		list_push_back (&all_list, e);
+		thread_priority_update (list_entry (e, struct thread, allelem), NULL);
+	}
+}
+
+/* Task 3. Priority from T's current recent_cpu and nice. */
+static int
+mlfqs_priority (struct thread *t) {
   int priority = FINT_NEAR(
       FSUB(
           FSUB(
@@ -742,19 +898,9 @@ thread_priority_update (struct thread *t, void *aux) {
       )
   );
 
-  int old = priority;
-
   priority = MAX (priority, PRI_MIN);
   priority = MIN (priority, PRI_MAX);
-
-  t->priority = priority;
-
-  // put thread well away in ready queue.
-  if (t->status == THREAD_READY)
-    {
-      list_remove(&t->elem);
-      list_push_back(ready_lists + t->priority, &t->elem);
-    }
+  return priority;
 }
 
 /* Task 3 */
@@ -768,38 +914,107 @@ thread_recent_cpu_increment (void) {
 	thread_current()->recent_cpu = FADD_INT(thread_current()->recent_cpu, 1);
 }
 
+/* Task 3. Once per second: updates load_avg and records this
+ * second's recent_cpu decay coefficient for lazy application. */
 void thread_load_avg_update (void) {
 	ASSERT(thread_mlfqs);
 	ASSERT(intr_context());
 
 	int ready_threads = (thread_current() == idle_thread) ? 0 : 1 ;
-	for (int i = PRI_MIN; i <= PRI_MAX; ++i)
-		ready_threads += list_size(ready_lists + i);
+	ready_threads += ready_cnt;
 
 	load_avg = FADD(FMUL(FFRAC(59, 60), load_avg), FMUL(FFRAC(1, 60), FIXED(ready_threads)));
+
+	decay_table[mlfqs_seconds % DECAY_HISTORY] =
+		FDIV(FMUL_INT(load_avg, 2), FADD_INT(FMUL_INT(load_avg, 2), 1));
+	mlfqs_seconds++;
 }
 
 int
 thread_highest_ready_priority (void) {
-	if (!thread_mlfqs) {
-		if (!list_empty(&ready_list))
-			return list_entry(list_front(&ready_list), struct thread, elem)->priority;
-		return PRI_MIN;
-	}
-	else {
-		for (int i = PRI_MAX; i >= PRI_MIN; --i)
-			if (!list_empty(ready_lists + i))
-				return i;
-		// all queues are empty.
+	// all queues are empty.
+	if (ready_bitmap == 0)
 		return PRI_MIN;
+	return ready_highest ();
+}
+
+/* Task 2. Task 3. Sets T's effective priority to PRIORITY.  If T
+   is waiting in the ready queue, it is moved to the back of the
+   queue for its new priority, so ready_lists[P] only ever holds
+   threads whose priority is P. */
+void
+thread_update_priority (struct thread *t, int priority) {
+	enum intr_level old_level = intr_disable ();
+
+	if (t->status == THREAD_READY && t->priority != priority) {
+		ready_remove (t);
+		t->priority = priority;
+		ready_push (t);
 	}
+	else
+		t->priority = priority;
+
+	intr_set_level (old_level);
+}
+
+/* Appends T to the ready queue for its priority. */
+static void
+ready_push (struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+
+	list_push_back (ready_lists + t->priority, &t->elem);
+	ready_bitmap |= (uint64_t) 1 << t->priority;
+	ready_cnt++;
+}
+
+/* Removes and returns the thread at the front of the highest
+   non-empty ready queue, which must exist. */
+static struct thread *
+ready_pop (void) {
+	int priority = ready_highest ();
+	struct list *queue = ready_lists + priority;
+	struct thread *t = list_entry (list_pop_front (queue), struct thread, elem);
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (list_empty (queue))
+		ready_bitmap &= ~((uint64_t) 1 << priority);
+	ready_cnt--;
+	return t;
+}
+
+/* Removes ready thread T from its ready queue. */
+static void
+ready_remove (struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	list_remove (&t->elem);
+	if (list_empty (ready_lists + t->priority))
+		ready_bitmap &= ~((uint64_t) 1 << t->priority);
+	ready_cnt--;
+}
+
+/* Returns the highest priority with a non-empty ready queue,
+   using a single bit scan (bsr) on whichever half of the 64-bit
+   bitmap is occupied.  ready_bitmap must be non-zero. */
+static int
+ready_highest (void) {
+	uint32_t hi = ready_bitmap >> 32;
+	uint32_t lo = ready_bitmap;
+
+	ASSERT (ready_bitmap != 0);
+
+	if (hi != 0)
+		return 63 - __builtin_clz (hi);
+	return 31 - __builtin_clz (lo);
 }
 
 /* Task 3. debug */
 void
 thread_print_one (struct thread *t, void *aux) {
-//	printf("%s proty : %d nice: %d snap: %d load_avg: %d status: ", t->name, t->priority, t->nice, t->snap_ticks, thread_get_load_avg());
-	printf("%s proty : %d nice: %d snap: %d status: ", t->name, t->priority, t->nice, t->snap_ticks);
+//	printf("%s proty : %d nice: %d wakeup: %lld load_avg: %d status: ", t->name, t->priority, t->nice, t->wakeup_tick, thread_get_load_avg());
+	printf("%s proty : %d nice: %d wakeup: %lld status: ", t->name, t->priority, t->nice, t->wakeup_tick);
 	if (t->status == THREAD_RUNNING)
 		printf("run");
 	else if (t->status == THREAD_READY)
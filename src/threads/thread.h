@@ -125,21 +125,34 @@ struct thread
     void *user_esp;
 
 
+    /* Statistics, owned by thread.c. */
+    long long user_ticks;               /* Timer ticks in user mode. */
+    long long kernel_ticks;             /* Timer ticks in kernel mode. */
+    long long voluntary_switches;       /* Switches away while blocked. */
+    long long involuntary_switches;     /* Switches away while ready. */
+    uint64_t ready_ns;                  /* Total ns spent ready to run. */
+    uint64_t ready_since;               /* When it last became ready. */
+    bool woken;                         /* Made ready by thread_unblock(). */
+
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
 
-    /* Task 1, amount of ticks remains to sleep. 0 if not in sleep state. */
-    int64_t snap_ticks;
+    /* Task 1, absolute tick to wake up at. 0 if not in sleep state. */
+    int64_t wakeup_tick;
 
     /* Task 2 */
     int base_priority;
     int donate_priority;
     struct list locks_acquired;
     struct lock *lock_waiting;
+    struct rwlock *rwlock_reading;      /* rwlock held shared, if any. */
+    struct list_elem rwlock_elem;       /* Element in its reader_list. */
+    struct rwlock *rwlock_draining;     /* rwlock whose readers we await. */
 
     /* Task 3*/
     int nice;
     fixed_t recent_cpu;
+    int64_t recent_cpu_seconds;         /* Decays applied to recent_cpu. */
   };
 
 /* If false (default), use round-robin scheduler.
@@ -167,6 +180,7 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
+void thread_preempt (void);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
@@ -180,21 +194,21 @@ void thread_set_nice (int);
 int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
 
-/* Task 2. ready_list sort cmp */
+/* Task 2. thread priority cmp, higher priority first */
 bool
 list_less_thread_priority (const struct list_elem *a,
                            const struct list_elem *b,
                            void *aux);
 
 /* thread_action_funcs used in project 1. */
-/* Task 1. */
-void thread_sleep_check (struct thread *t, void *aux);
 /* Task 3. */
 void thread_recent_cpu_increment (void);
 void thread_load_avg_update (void);
 void thread_recent_cpu_update (struct thread *t, void *aux);
 void thread_priority_update (struct thread *t, void *aux);
+void thread_mlfqs_refresh (void);
 int thread_highest_ready_priority(void);
+void thread_update_priority (struct thread *t, int priority);
 void thread_print_all (void);
 void thread_print_one (struct thread*, void*);
 #endif /* threads/thread.h */
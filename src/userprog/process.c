@@ -8,6 +8,7 @@
 #include <string.h>
 #include <threads/synch.h>
 #include <threads/malloc.h>
+#include <threads/slab.h>
 #include <devices/timer.h>
 #include <vm/page.h>
 #include "userprog/gdt.h"
@@ -260,8 +261,8 @@ start_process (void *file_name_)
 //  printf("see threads waiting for the condition variable\n");
 //  if (!list_empty(&hash_table_cv.waiters)) {
 //	  for (struct list_elem *e = list_begin(&hash_table_cv.waiters); e != list_end(&hash_table_cv.waiters); e = e->next) {
-//		  struct semaphore_elem *waiter_semaphore = list_entry(e, struct semaphore_elem, elem);
-//		  thread_print_one(waiter_semaphore->wait_thread, NULL);
+//		  struct cond_waiter *waiter = list_entry(e, struct cond_waiter, elem);
+//		  thread_print_one(waiter->thread, NULL);
 //	  }
 //  }
 	cond_broadcast (&hash_table_cv, &hash_table_lock);
@@ -353,7 +354,7 @@ process_exit (void)
       struct file_descriptor *fd = list_entry(e, struct file_descriptor, elem);
       list_pop_front(fd_list);
       fs_close(fd->file);
-      free(fd);
+      kmem_cache_free(fd_cache, fd);
     }
 
   struct list *mmap_list = &cur->mmap_lsit;
@@ -364,6 +365,12 @@ process_exit (void)
       sys_munmap(mmap_info->id);
     }
 
+  /* Drop our pages while the executable is still open, because
+     shared pages are looked up by its inode. */
+  acquire_frame_lock();
+  supp_page_table_destroy(&cur->supp_page_table);
+  release_frame_lock();
+
   /* Update the hash table */
   if (lock_held_by_current_thread (&hash_table_lock))
     {
@@ -391,10 +398,6 @@ process_exit (void)
       lock_release (&entry->lk);
     }
 
-  acquire_frame_lock();
-  supp_page_table_destroy(&cur->supp_page_table);
-  release_frame_lock();
-
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
@@ -730,17 +733,22 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   Nothing is read here.  Each page is only recorded in the
+   supplemental page table, and is read from FILE, or given a
+   zeroed frame if it has no bytes to read, on its first fault.
+
    Return true if successful, false if a memory allocation error
-   or disk read error occurs. */
+   occurs or the segment overlaps a page that is already loaded. */
 static bool
 load_segment (struct file *file, off_t ofs, uint8_t *upage,
               uint32_t read_bytes, uint32_t zero_bytes, bool writable) 
 {
+  struct thread *t = thread_current ();
+
   ASSERT ((read_bytes + zero_bytes) % PGSIZE == 0);
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
-  fs_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
       /* Calculate how to fill this page.
@@ -748,32 +756,22 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
          and zero the final PAGE_ZERO_BYTES bytes. */
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-      /* Get a page of memory. */
-
-
-      acquire_frame_lock();
-      uint8_t *kpage = allocate_frame (PAL_USER, upage);
-      release_frame_lock();
-      if (kpage == NULL)
+      bool success;
+
+      /* Record this page. */
+      if (page_read_bytes > 0)
+        success = set_supp_exec_entry (&t->supp_page_table, upage, file, ofs,
+                                       page_read_bytes, writable);
+      else
+        success = set_supp_zero_entry (&t->supp_page_table, upage, writable);
+      if (!success)
         return false;
 
-
-      /* Load this page. */
-      off_t length = fs_read (file, kpage, page_read_bytes);
-      ASSERT (length == page_read_bytes)
-
-      memset (kpage + page_read_bytes, 0, page_zero_bytes);
-
-      /* Add the page to the process's address space. */
-      bool success = install_page (upage, kpage, writable);
-      ASSERT (success);
-
       /* Advance. */
       read_bytes -= page_read_bytes;
       zero_bytes -= page_zero_bytes;
+      ofs += page_read_bytes;
       upage += PGSIZE;
-
     }
 
   return true;
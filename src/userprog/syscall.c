@@ -1,9 +1,11 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include <threads/synch.h>
 #include <filesys/filesys.h>
 #include <threads/malloc.h>
+#include <threads/slab.h>
 #include <filesys/file.h>
 #include <devices/input.h>
 #include <vm/page.h>
@@ -20,17 +22,26 @@
 #include "vm/frame.h"
 
 
+struct kmem_cache *fd_cache;
+
 static void syscall_handler (struct intr_frame *);
 
-/* TODO: this check may be wrong */
 static void check_legal (const void *uaddr);
 
+static void load_and_pin_string(const char *str);
+
+static void unpin_string(const char *str);
+
+static bool load_and_pin_page(void *upage, bool write);
+
 static void check_valid(const void *uaddr);
 
 void
 syscall_init (void) 
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
+  fd_cache = kmem_cache_create ("file_descriptor",
+                                sizeof (struct file_descriptor), NULL);
 }
 
 static bool sys_create (const char *file, unsigned initial_size);
@@ -68,11 +79,9 @@ sys_wait (pid_t pid)
 static pid_t
 sys_exec (const char *cmd_line)
 {
-  check_legal (cmd_line);
-  check_legal (cmd_line + 1);
-  check_legal (cmd_line + 2);
-  check_legal (cmd_line + 3);
+  load_and_pin_string (cmd_line);
   pid_t pid = process_execute (cmd_line);
+  unpin_string (cmd_line);
   if (pid == TID_ERROR)
     return -1;
   return pid;
@@ -142,7 +151,8 @@ static struct file_descriptor* get_file_descriptor(struct thread *t, int fd_id);
 
 static struct mmap_info* get_mmap_info(struct thread *t, int mapid);
 
-static void load_and_pin_buffer(const void *buffer, unsigned length);
+static void load_and_pin_buffer(const void *buffer, unsigned length,
+                                bool write);
 
 static void unpin_buffer(const void *buffer, unsigned length);
 
@@ -217,35 +227,41 @@ syscall_handler (struct intr_frame *f UNUSED)
 bool
 sys_create (const char *file, unsigned initial_size)
 {
-  check_legal (file);
+  load_and_pin_string (file);
   bool success;
   success = fs_create(file, initial_size);
+  unpin_string (file);
   return success;
 }
 
 bool
 sys_remove (const char *file)
 {
-  check_legal (file);
+  load_and_pin_string (file);
   bool success;
   success = fs_remove(file);
+  unpin_string (file);
   return success;
 }
 
 int
 sys_open (const char *file)
 {
-  check_legal (file);
+  load_and_pin_string (file);
 
   struct file * f;
-  struct file_descriptor * fd = malloc(sizeof(struct file_descriptor));
+  struct file_descriptor * fd = kmem_cache_alloc(fd_cache);
   if (!fd)
-    return -1;
+    {
+      unpin_string (file);
+      return -1;
+    }
 
   f = fs_open(file);
+  unpin_string (file);
   if (!f)
     {
-      free(fd);
+      kmem_cache_free(fd_cache, fd);
       return -1;
     }
   fd->file = f;
@@ -277,14 +293,16 @@ sys_read(int fd_id, void *buffer, unsigned length)
 
   if (fd_id == STDIN_FILENO)
     {
+      /* Loading the buffer first rejects read-only pages, which
+       * put_user() would write to anyway. */
       uint8_t * udst = (uint8_t *) buffer;
+      load_and_pin_buffer(buffer, length, true);
       for (unsigned i = 0; i < length; ++i)
         {
-          if (!put_user(udst, input_getc())) {
-            sys_exit(-1);
-          }
+          put_user(udst, input_getc());
           ++udst;
         }
+      unpin_buffer(buffer, length);
       return length;
     }
 
@@ -295,7 +313,7 @@ sys_read(int fd_id, void *buffer, unsigned length)
   struct file_descriptor * fd = get_file_descriptor(thread_current(), fd_id);
   if (!fd)
     return -1;
-  load_and_pin_buffer(buffer, length);
+  load_and_pin_buffer(buffer, length, true);
   size = fs_read(fd->file, buffer, length);
   unpin_buffer(buffer, length);
   return size;
@@ -324,7 +342,7 @@ sys_write (int fd_id, const void *buffer, unsigned length)
     {
       return -1;
     }
-  load_and_pin_buffer(buffer, length);
+  load_and_pin_buffer(buffer, length, false);
   size = fs_write(fd->file, buffer, length);
   unpin_buffer(buffer, length);
   return size;
@@ -358,7 +376,7 @@ sys_close (int fd_id)
     return;
   fs_close(fd->file);
   list_remove(&fd->elem);
-  free(fd);
+  kmem_cache_free(fd_cache, fd);
 }
 
 
@@ -439,13 +457,12 @@ sys_munmap (mapid_t mapid)
   free(mmap_info);
 }
 
-/* TODO: this check may be wrong */
+/* Kills the process unless UADDR is a valid user address. Reading
+   it faults its page in, since executables are loaded lazily. */
 void
 check_legal (const void *uaddr)
 {
-  struct thread *cur = thread_current();
-  if (uaddr == NULL || !is_user_vaddr(uaddr) ||
-      (pagedir_get_page (cur->pagedir, uaddr)) == NULL)
+  if (uaddr == NULL || !is_user_vaddr(uaddr) || get_user(uaddr) == -1)
     sys_exit(-1);
 }
 
@@ -513,27 +530,19 @@ get_mmap_info(struct thread *t, int mapid)
 }
 
 static void
-load_and_pin_buffer(const void *buffer, unsigned length)
+load_and_pin_buffer(const void *buffer, unsigned length, bool write)
 {
-  struct thread *cur = thread_current();
-
   const void *buffer_end = buffer + length;
   for (void *upage = pg_round_down(buffer); upage < buffer_end; upage += PGSIZE)
   {
-    if (get_user(upage) == -1)
+    if (!load_and_pin_page(upage, write))
     {
+      /* A pin left behind would keep a shared frame from ever
+       * being evicted. */
+      if (upage > buffer)
+        unpin_buffer(buffer, upage - buffer);
       sys_exit(-1);
     }
-    struct supp_entry *entry = get_supp_entry(&cur->supp_page_table, upage);
-    ASSERT (entry != NULL);
-    acquire_frame_lock();
-    if (!load_page(entry))
-    {
-      PANIC ("Loading buffer failed");
-    }
-    ASSERT (entry->kpage != NULL);
-    pin_frame(entry->kpage);
-    release_frame_lock();
   }
 }
 
@@ -554,3 +563,61 @@ unpin_buffer(const void *buffer, unsigned length)
   }
 }
 
+/* Loads and pins the pages of the user string STR, so that a file
+   system call does not fault on it while holding fs_lock. Kills
+   the process if STR does not lie in its address space. */
+static void
+load_and_pin_string(const char *str)
+{
+  const char *p = str;
+
+  for (;;)
+    {
+      if (p == NULL || !is_user_vaddr(p)
+          || !load_and_pin_page(pg_round_down(p), false))
+        {
+          if (p != str)
+            unpin_buffer(str, p - str);
+          sys_exit(-1);
+        }
+
+      const char *page_end = (const char *) pg_round_down(p) + PGSIZE;
+      for (; p < page_end; p++)
+        if (*p == '\0')
+          return;
+    }
+}
+
+static void
+unpin_string(const char *str)
+{
+  unpin_buffer(str, strlen(str) + 1);
+}
+
+/* Brings the user page UPAGE in, growing the stack if need be, and
+   pins its frame. Returns false if UPAGE is not in the process's
+   address space, or if WRITE and the page is read-only. */
+static bool
+load_and_pin_page(void *upage, bool write)
+{
+  struct thread *cur = thread_current();
+
+  if (get_user(upage) == -1)
+    return false;
+  struct supp_entry *entry = get_supp_entry(&cur->supp_page_table, upage);
+  ASSERT (entry != NULL);
+  /* The kernel ignores read-only mappings, and a read-only page
+   * may be shared with other processes. */
+  if (write && !entry->writable)
+    return false;
+
+  acquire_frame_lock();
+  if (!load_page(entry))
+  {
+    PANIC ("Loading buffer failed");
+  }
+  ASSERT (entry->kpage != NULL);
+  pin_frame(entry->kpage);
+  release_frame_lock();
+  return true;
+}
@@ -21,6 +21,9 @@ struct mmap_info {
 
 };
 
+/* Cache of struct file_descriptor. */
+extern struct kmem_cache *fd_cache;
+
 void syscall_init (void);
 
 void sys_munmap (mapid_t mapid);
@@ -3,9 +3,12 @@
 #include <threads/thread.h>
 #include <threads/synch.h>
 #include <threads/malloc.h>
+#include <threads/slab.h>
 #include <threads/vaddr.h>
+#include <filesys/inode.h>
 #include <userprog/pagedir.h>
 #include <stdio.h>
+#include <string.h>
 #include "vm/frame.h"
 #include "userprog/syscall.h"
 #include "page.h"
@@ -16,37 +19,96 @@ struct frame_entry
   void *kpage;
   void *upage;
   struct thread *owner;
-  bool pinned;
+  int pin_cnt;
+
+  /* A read-only page of an executable is kept in one frame for
+   * every process running it. Such a frame has no owner; it is
+   * found by INODE and OFFSET in 'shared_table', and is mapped by
+   * the 'share_cnt' supp_entry's in 'sharers'. */
+  struct inode *inode;            /* NULL if not shared. */
+  off_t offset;
+  bool loading;                   /* Being read in by its first sharer. */
+  unsigned share_cnt;
+  struct list sharers;
 
   struct hash_elem helem;
+  struct hash_elem shelem;
   struct list_elem lelem;
 };
 
 static struct hash frame_table;
 
+static struct hash shared_table;
+
 static struct list frame_list;
 
+static struct kmem_cache *frame_cache;
+
 static struct list_elem *hand_ptr = NULL;
 
-static struct frame_entry* get_frame_entry(void *kpage);
+/* Evictions write pages out without holding frame_lock, so that
+ * faults on other pages can go on meanwhile.  A thread that needs
+ * a page being evicted, or a shared page being read in, waits on
+ * 'frame_io_done'. */
+static struct condition frame_io_done;
 
-static void set_pinned(void *kpage, bool pinned);
+/* Number of evictions and page-ins that have released frame_lock
+ * for I/O while holding frames pinned. A thread that finds every
+ * frame pinned waits for one of them unless there are none. */
+static int frame_io_cnt;
+
+/* -pageout-low, -pageout-high: The pageout daemon starts evicting
+ * when fewer than 'pageout_low' user frames are free, and stops
+ * when 'pageout_high' are. A low watermark of 0 disables it. */
+size_t pageout_low = 16;
+size_t pageout_high = 32;
+
+#ifndef NOSWAP
+static struct semaphore pageout_sema;
+
+static bool pageout_started;
+
+static bool pageout_running;
+#endif
+
+#ifndef NOSWAP
+static void evict_frames(struct frame_entry **entries, size_t cnt);
+
+static void unshare_frame(struct frame_entry *entry);
+
+static void pageout_daemon(void *aux);
 
 static struct frame_entry* next_frame_entry(void);
 
 static struct frame_entry* pick_victim(void);
 
+static bool test_and_clear_accessed(struct frame_entry *entry);
+#endif
+
+static struct frame_entry* get_frame_entry(void *kpage);
+
+static void set_pinned(void *kpage, bool pinned);
+
 static unsigned frame_hash_func (const struct hash_elem *e, void *aux);
 
 static bool frame_less_func (const struct hash_elem *a,
                              const struct hash_elem *b,
                              void *aux);
 
+static unsigned shared_hash_func (const struct hash_elem *e, void *aux);
+
+static bool shared_less_func (const struct hash_elem *a,
+                              const struct hash_elem *b,
+                              void *aux);
+
 void
 frame_init()
 {
   lock_init(&frame_lock);
+  cond_init(&frame_io_done);
+  frame_cache = kmem_cache_create ("frame_entry", sizeof (struct frame_entry), NULL);
   hash_init(&frame_table, frame_hash_func, frame_less_func, NULL);
+  hash_init(&shared_table, shared_hash_func, shared_less_func, NULL);
   list_init(&frame_list);
 }
 
@@ -61,33 +123,48 @@ allocate_frame(enum palloc_flags flags, void *upage)
 #ifdef NOSWAP
       return NULL;
 #else
-      struct frame_entry *entry = pick_victim();
-      ASSERT (entry != NULL);
-      ASSERT (entry->owner != NULL);
-
-
-      struct supp_entry *evicted = get_supp_entry(&(entry->owner->supp_page_table),
-                                                  entry->upage);
-
-      ASSERT (evicted != NULL);
-      evict_page(evicted, entry->owner->pagedir);
+      /* Every frame may be pinned by evictions or page-ins in
+       * progress. Wait for one of them to finish and look again. */
+      struct frame_entry *entry;
+      while ((entry = pick_victim()) == NULL)
+        {
+          if (frame_io_cnt == 0)
+            PANIC ("Can't find a victim");
+          wait_frame_io();
+        }
+      evict_frames(&entry, 1);
 
       entry->upage = upage;
       entry->owner = thread_current();
-      entry->pinned = true;
 
+      if (flags & PAL_ZERO)
+        memset (entry->kpage, 0, PGSIZE);
       return entry->kpage;
 #endif
     }
 
 
-  struct frame_entry *entry = malloc(sizeof(struct frame_entry));
+#ifndef NOSWAP
+  /* Wake the pageout daemon before we run out. */
+  if (pageout_started && !pageout_running
+      && palloc_user_free_cnt() < pageout_low)
+    {
+      pageout_running = true;
+      sema_up(&pageout_sema);
+    }
+#endif
+
+  struct frame_entry *entry = kmem_cache_alloc(frame_cache);
   ASSERT (entry != NULL)
 
   entry->kpage = kpage;
   entry->upage = upage;
   entry->owner = thread_current();
-  entry->pinned = true;
+  entry->pin_cnt = 1;
+  entry->inode = NULL;
+  entry->loading = false;
+  entry->share_cnt = 0;
+  list_init(&entry->sharers);
   struct hash_elem *prev = hash_insert(&frame_table, &entry->helem);
   ASSERT (prev == NULL);
 
@@ -105,16 +182,36 @@ free_frame(void *kpage, bool free_page)
   ASSERT (pg_ofs(kpage) == 0);
 
   struct frame_entry *entry = get_frame_entry(kpage);
+  ASSERT (entry->share_cnt == 0);
+  if (entry->inode != NULL)
+    hash_delete(&shared_table, &entry->shelem);
   hash_delete(&frame_table, &entry->helem);
-  /* Removing frame_entry from frame_list may invalid hand_ptr.
-   * On the other hand, freeing a frame means that the next
-   * allocation wouldn't trigger eviction. Hence here I set
-   * 'hand_ptr = NULL'. Next time of eviction would start from
-   * list_begin(). */
-  hand_ptr = NULL;
+  /* Keep the clock hand where it is, so that the frames just past
+   * it do not lose their second chance. */
+  if (hand_ptr == &entry->lelem)
+    hand_ptr = list_prev(hand_ptr);
   list_remove(&entry->lelem);
   if (free_page) palloc_free_page(kpage);
-  free(entry);
+  kmem_cache_free(frame_cache, entry);
+}
+
+/* Starts the pageout daemon, which evicts pages in the background
+ * to keep between 'pageout_low' and 'pageout_high' user frames
+ * free, so that faults seldom have to wait for an eviction. Must
+ * be called after the scheduler and swap are running. */
+void
+pageout_init()
+{
+#ifndef NOSWAP
+  if (pageout_low == 0)
+    return;
+  if (pageout_high < pageout_low)
+    pageout_high = pageout_low;
+
+  sema_init(&pageout_sema, 0);
+  pageout_started = true;
+  thread_create("pageout", PRI_DEFAULT, pageout_daemon, NULL);
+#endif
 }
 
 void
@@ -129,6 +226,119 @@ unpin_frame(void *kpage)
   set_pinned(kpage, false);
 }
 
+/* Waits until an eviction or a read of a shared page in progress
+ * finishes. Must be called with frame_lock held, which is
+ * released while waiting. */
+void
+wait_frame_io()
+{
+  ASSERT (lock_held_by_current_thread(&frame_lock));
+  cond_wait(&frame_io_done, &frame_lock);
+}
+
+/* Records that the caller is about to release frame_lock for I/O
+ * on frames it has pinned. */
+void
+begin_frame_io()
+{
+  ASSERT (lock_held_by_current_thread(&frame_lock));
+  frame_io_cnt++;
+}
+
+/* Records that the I/O begun by begin_frame_io() is over and its
+ * frames are unpinned, and wakes the threads waiting for it. */
+void
+end_frame_io()
+{
+  ASSERT (lock_held_by_current_thread(&frame_lock));
+  ASSERT (frame_io_cnt > 0);
+  frame_io_cnt--;
+  cond_broadcast(&frame_io_done, &frame_lock);
+}
+
+/* Returns the frame holding the page at OFFSET in INODE for
+ * sharing, waiting for it if it is still being read in, or NULL
+ * if no process has it in memory. */
+void*
+find_shared_frame(struct inode *inode, off_t offset)
+{
+  ASSERT (lock_held_by_current_thread(&frame_lock));
+
+  struct frame_entry tmp;
+  tmp.inode = inode;
+  tmp.offset = offset;
+
+  for (;;)
+    {
+      struct hash_elem *e = hash_find(&shared_table, &tmp.shelem);
+      if (e == NULL)
+        return NULL;
+
+      struct frame_entry *entry = hash_entry(e, struct frame_entry, shelem);
+      if (!entry->loading)
+        return entry->kpage;
+      wait_frame_io();
+    }
+}
+
+/* Offers the frame KPAGE, just allocated and still pinned, as the
+ * frame holding the page at OFFSET in INODE. Other processes wait
+ * for it in find_shared_frame() until the caller has read the
+ * page and added itself with add_frame_sharer(). */
+void
+share_frame(void *kpage, struct inode *inode, off_t offset)
+{
+  ASSERT (lock_held_by_current_thread(&frame_lock));
+
+  struct frame_entry *entry = get_frame_entry(kpage);
+  ASSERT (entry->pin_cnt == 1);
+  ASSERT (entry->inode == NULL);
+
+  entry->owner = NULL;
+  entry->upage = NULL;
+  entry->inode = inode;
+  entry->offset = offset;
+  entry->loading = true;
+  struct hash_elem *prev = hash_insert(&shared_table, &entry->shelem);
+  ASSERT (prev == NULL);
+}
+
+/* Records that SHARER maps the shared frame KPAGE. The first
+ * sharer is the one that read the page in, so this ends the read
+ * and unpins the frame; the caller then calls end_frame_io(). */
+void
+add_frame_sharer(void *kpage, struct supp_entry *sharer)
+{
+  ASSERT (lock_held_by_current_thread(&frame_lock));
+
+  struct frame_entry *entry = get_frame_entry(kpage);
+  ASSERT (entry->inode != NULL);
+
+  if (entry->loading)
+    {
+      entry->loading = false;
+      entry->pin_cnt--;
+    }
+  list_push_back(&entry->sharers, &sharer->share_elem);
+  entry->share_cnt++;
+}
+
+/* Records that SHARER no longer maps the shared frame KPAGE, and
+ * frees the frame once nobody does. */
+void
+remove_frame_sharer(void *kpage, struct supp_entry *sharer)
+{
+  ASSERT (lock_held_by_current_thread(&frame_lock));
+
+  struct frame_entry *entry = get_frame_entry(kpage);
+  ASSERT (entry->inode != NULL);
+  ASSERT (entry->share_cnt > 0);
+
+  list_remove(&sharer->share_elem);
+  if (--entry->share_cnt == 0)
+    free_frame(kpage, true);
+}
+
 void
 acquire_frame_lock()
 {
@@ -143,6 +353,100 @@ release_frame_lock()
   lock_release(&frame_lock);
 }
 
+#ifndef NOSWAP
+/* Writes out the pages in the CNT frames in ENTRIES, which
+ * pick_victim() has pinned, and which stay pinned and belong to
+ * nobody afterward. Drops frame_lock for the I/O. */
+static void
+evict_frames(struct frame_entry **entries, size_t cnt)
+{
+  ASSERT (lock_held_by_current_thread(&frame_lock));
+  ASSERT (cnt <= EVICT_BATCH);
+
+  struct supp_entry *evicted[EVICT_BATCH];
+  uint32_t *pagedirs[EVICT_BATCH];
+  size_t evicted_cnt = 0;
+
+  for (size_t i = 0; i < cnt; ++i)
+    {
+      struct frame_entry *entry = entries[i];
+      ASSERT (entry->pin_cnt == 1);
+
+      if (entry->inode != NULL)
+        {
+          unshare_frame(entry);
+          continue;
+        }
+
+      ASSERT (entry->owner != NULL);
+      evicted[evicted_cnt] = get_supp_entry(&(entry->owner->supp_page_table),
+                                            entry->upage);
+      ASSERT (evicted[evicted_cnt] != NULL);
+      pagedirs[evicted_cnt++] = entry->owner->pagedir;
+    }
+  if (evicted_cnt == 0)
+    return;
+
+  /* The victims are pinned while they are in transit, so that
+   * nobody else picks them while evict_pages() drops frame_lock
+   * for the I/O. */
+  begin_frame_io();
+  evict_pages(evicted, pagedirs, evicted_cnt);
+  end_frame_io();
+}
+
+/* Unmaps the shared frame ENTRY from every process that maps it.
+ * Its page is never changed, so there is nothing to write, and
+ * each sharer reads it again on its next fault. */
+static void
+unshare_frame(struct frame_entry *entry)
+{
+  while (!list_empty(&entry->sharers))
+    {
+      struct list_elem *e = list_pop_front(&entry->sharers);
+      unmap_shared_page(list_entry(e, struct supp_entry, share_elem));
+    }
+  entry->share_cnt = 0;
+  hash_delete(&shared_table, &entry->shelem);
+  entry->inode = NULL;
+}
+
+/* Runs the clock over the frame table whenever allocate_frame()
+ * finds the free user frames below the low watermark, evicting
+ * victims and returning their frames to the page allocator until
+ * the high watermark is reached. Clean victims cost no I/O, and
+ * dirty ones are written out here instead of in a page fault. */
+static void
+pageout_daemon(void *aux UNUSED)
+{
+  for (;;)
+    {
+      sema_down(&pageout_sema);
+
+      acquire_frame_lock();
+      while (palloc_user_free_cnt() < pageout_high)
+        {
+          /* Evict a batch of victims together, so that their
+           * pages are written to consecutive swap regions. */
+          struct frame_entry *victims[EVICT_BATCH];
+          size_t want = pageout_high - palloc_user_free_cnt();
+          size_t cnt = 0;
+
+          while (cnt < want && cnt < EVICT_BATCH
+                 && (victims[cnt] = pick_victim()) != NULL)
+            cnt++;
+          if (cnt == 0)
+            break;
+
+          evict_frames(victims, cnt);
+          for (size_t i = 0; i < cnt; ++i)
+            free_frame(victims[i]->kpage, true);
+        }
+      pageout_running = false;
+      release_frame_lock();
+    }
+}
+
 static struct frame_entry*
 next_frame_entry()
 {
@@ -158,6 +462,9 @@ next_frame_entry()
   return entry;
 }
 
+/* Runs the clock until it finds an unpinned frame whose page was
+ * not accessed since the hand last passed it, and returns that
+ * frame pinned, or NULL if there is none. */
 static struct frame_entry*
 pick_victim()
 {
@@ -167,22 +474,53 @@ pick_victim()
   for (size_t i = 0; i < max; ++i)
   {
     struct frame_entry *entry = next_frame_entry();
-    if (entry->pinned)
+    if (entry->pin_cnt > 0)
       continue;
-    ASSERT (entry->owner != NULL);
-    uint32_t *pagedir = entry->owner->pagedir;
-    bool accessed = pagedir_is_accessed(pagedir, entry->upage)
-                    || pagedir_is_accessed(pagedir, entry->kpage);
-    if (!accessed)
-      return entry;
-
-    pagedir_set_accessed(pagedir, entry->upage, false);
-    pagedir_set_accessed(pagedir, entry->kpage, false);
+    if (!test_and_clear_accessed(entry))
+      {
+        entry->pin_cnt = 1;
+        return entry;
+      }
   }
 
-  PANIC ("Can't find a victim");
+  return NULL;
 }
 
+/* Returns whether the page in frame ENTRY was accessed through
+ * any of its mappings since the last call, and clears the
+ * accessed bits. */
+static bool
+test_and_clear_accessed(struct frame_entry *entry)
+{
+  bool accessed = false;
+
+  if (entry->inode == NULL)
+    {
+      ASSERT (entry->owner != NULL);
+      uint32_t *pagedir = entry->owner->pagedir;
+      accessed = pagedir_is_accessed(pagedir, entry->upage)
+                 || pagedir_is_accessed(pagedir, entry->kpage);
+      pagedir_set_accessed(pagedir, entry->upage, false);
+      pagedir_set_accessed(pagedir, entry->kpage, false);
+      return accessed;
+    }
+
+  struct list_elem *e;
+  for (e = list_begin(&entry->sharers); e != list_end(&entry->sharers);
+       e = list_next(e))
+    {
+      struct supp_entry *sharer = list_entry(e, struct supp_entry, share_elem);
+      if (pagedir_is_accessed(sharer->pagedir, sharer->upage)
+          || pagedir_is_accessed(sharer->pagedir, entry->kpage))
+        accessed = true;
+      pagedir_set_accessed(sharer->pagedir, sharer->upage, false);
+      pagedir_set_accessed(sharer->pagedir, entry->kpage, false);
+    }
+  return accessed;
+}
+
+#endif
+
 static struct frame_entry*
 get_frame_entry(void *kpage)
 {
@@ -203,14 +541,21 @@ get_frame_entry(void *kpage)
   return hash_entry(e, struct frame_entry, helem);
 }
 
+/* Pins or unpins KPAGE. A shared frame can be pinned by several
+ * processes at once, so pins are counted. */
 static void
 set_pinned(void *kpage, bool pinned)
 {
   ASSERT (lock_held_by_current_thread(&frame_lock));
 
   struct frame_entry *entry = get_frame_entry(kpage);
-  ASSERT (entry->pinned != pinned);
-  entry->pinned = pinned;
+  if (pinned)
+    entry->pin_cnt++;
+  else
+    {
+      ASSERT (entry->pin_cnt > 0);
+      entry->pin_cnt--;
+    }
 }
 
 static unsigned
@@ -228,4 +573,23 @@ frame_less_func (const struct hash_elem *a,
   struct frame_entry *entry_a = hash_entry(a, struct frame_entry, helem);
   struct frame_entry *entry_b = hash_entry(b, struct frame_entry, helem);
   return entry_a->kpage < entry_b->kpage;
-}
\ No newline at end of file
+}
+
+static unsigned
+shared_hash_func (const struct hash_elem *e, void *aux UNUSED)
+{
+  struct frame_entry *entry = hash_entry(e, struct frame_entry, shelem);
+  return hash_int((int)(entry->inode)) ^ hash_int(entry->offset);
+}
+
+static bool
+shared_less_func (const struct hash_elem *a,
+                  const struct hash_elem *b,
+                  void *aux UNUSED)
+{
+  struct frame_entry *entry_a = hash_entry(a, struct frame_entry, shelem);
+  struct frame_entry *entry_b = hash_entry(b, struct frame_entry, shelem);
+  if (entry_a->inode != entry_b->inode)
+    return entry_a->inode < entry_b->inode;
+  return entry_a->offset < entry_b->offset;
+}
@@ -2,13 +2,22 @@
 #define VM_FRAME_H
 
 #include <threads/palloc.h>
+#include <filesys/off_t.h>
 #include "lib/kernel/hash.h"
 #include "threads/synch.h"
 
 struct lock frame_lock;
 
+struct inode;
+struct supp_entry;
+
+extern size_t pageout_low;
+extern size_t pageout_high;
+
 void frame_init(void);
 
+void pageout_init(void);
+
 void* allocate_frame(enum palloc_flags flags, void *upage);
 
 void free_frame(void *kpage, bool free_page);
@@ -17,6 +26,20 @@ void pin_frame(void *kpage);
 
 void unpin_frame(void *kpage);
 
+void wait_frame_io(void);
+
+void begin_frame_io(void);
+
+void end_frame_io(void);
+
+void* find_shared_frame(struct inode *inode, off_t offset);
+
+void share_frame(void *kpage, struct inode *inode, off_t offset);
+
+void add_frame_sharer(void *kpage, struct supp_entry *sharer);
+
+void remove_frame_sharer(void *kpage, struct supp_entry *sharer);
+
 void acquire_frame_lock();
 
 void release_frame_lock();
@@ -1,14 +1,19 @@
 #include <threads/malloc.h>
+#include <threads/slab.h>
 #include <userprog/pagedir.h>
 #include <threads/thread.h>
+#include <threads/vaddr.h>
 #include <filesys/file.h>
 #include <stdio.h>
+#include <string.h>
 #include <threads/synch.h>
 #include <filesys/filesys.h>
 #include "vm/page.h"
 #include "frame.h"
 
 
+static struct kmem_cache *supp_cache;
+
 static unsigned supp_hash_func (const struct hash_elem *e, void *aux);
 
 static bool supp_less_func (const struct hash_elem *a,
@@ -17,6 +22,22 @@ static bool supp_less_func (const struct hash_elem *a,
 
 static void supp_destroy_func (struct hash_elem *e, void *aux);
 
+static bool is_shared(const struct supp_entry *entry);
+
+static bool load_shared_page(struct supp_entry *entry);
+
+static void read_file_page(struct supp_entry *entry, void *kpage);
+
+static bool load_swap_pages(struct supp_entry *entry);
+
+static struct supp_entry* swap_neighbor(struct supp_entry *entry, int delta);
+
+void
+page_init(void)
+{
+  supp_cache = kmem_cache_create ("supp_entry", sizeof (struct supp_entry), NULL);
+}
+
 void
 supp_page_table_init(struct hash *supp_page_table)
 {
@@ -33,7 +54,7 @@ bool
 set_supp_frame_entry(struct hash *supp_page_table,
                      void *upage, void *kpage, bool writable)
 {
-  struct supp_entry *entry = (struct supp_entry *) malloc(sizeof(struct supp_entry));
+  struct supp_entry *entry = kmem_cache_alloc(supp_cache);
 
   entry->upage = upage;
   entry->state = ON_FRAME;
@@ -41,6 +62,7 @@ set_supp_frame_entry(struct hash *supp_page_table,
   entry->kpage = kpage;
   entry->sid = -1;
   entry->file = NULL;
+  entry->mmap = false;
 
   struct hash_elem *prev = hash_insert(supp_page_table, &entry->elem);
   if (prev == NULL)
@@ -52,7 +74,7 @@ set_supp_frame_entry(struct hash *supp_page_table,
   }
   else
   {
-    free(entry);
+    kmem_cache_free(supp_cache, entry);
     return false;
   }
 }
@@ -61,7 +83,7 @@ bool
 set_supp_mmap_entry(struct hash *supp_page_table, void *upage,
                     struct file *file, uint32_t offset, uint32_t read_bytes)
 {
-  struct supp_entry *entry = (struct supp_entry *) malloc(sizeof(struct supp_entry));
+  struct supp_entry *entry = kmem_cache_alloc(supp_cache);
 
   entry->upage = upage;
   entry->state = IN_FILE;
@@ -71,13 +93,69 @@ set_supp_mmap_entry(struct hash *supp_page_table, void *upage,
   entry->file = file;
   entry->offset = offset;
   entry->read_bytes = read_bytes;
+  entry->mmap = true;
+
+  struct hash_elem *prev = hash_insert(supp_page_table, &entry->elem);
+  if (prev == NULL)
+    return true;
+  else
+    {
+      kmem_cache_free(supp_cache, entry);
+      return false;
+    }
+}
+
+/* Records that UPAGE holds READ_BYTES bytes of the executable
+ * FILE at OFFSET, followed by zeros, to be read on first fault. */
+bool
+set_supp_exec_entry(struct hash *supp_page_table, void *upage,
+                    struct file *file, uint32_t offset,
+                    uint32_t read_bytes, bool writable)
+{
+  struct supp_entry *entry = kmem_cache_alloc(supp_cache);
+
+  entry->upage = upage;
+  entry->state = IN_EXEC;
+  entry->writable = writable;
+  entry->kpage = NULL;
+  entry->sid = -1;
+  entry->file = file;
+  entry->offset = offset;
+  entry->read_bytes = read_bytes;
+  entry->mmap = false;
 
   struct hash_elem *prev = hash_insert(supp_page_table, &entry->elem);
   if (prev == NULL)
     return true;
   else
     {
-      free(entry);
+      kmem_cache_free(supp_cache, entry);
+      return false;
+    }
+}
+
+/* Records that UPAGE is all zeros, to be given a zeroed frame on
+ * first fault without any disk I/O. */
+bool
+set_supp_zero_entry(struct hash *supp_page_table, void *upage,
+                    bool writable)
+{
+  struct supp_entry *entry = kmem_cache_alloc(supp_cache);
+
+  entry->upage = upage;
+  entry->state = ZERO_FILL;
+  entry->writable = writable;
+  entry->kpage = NULL;
+  entry->sid = -1;
+  entry->file = NULL;
+  entry->mmap = false;
+
+  struct hash_elem *prev = hash_insert(supp_page_table, &entry->elem);
+  if (prev == NULL)
+    return true;
+  else
+    {
+      kmem_cache_free(supp_cache, entry);
       return false;
     }
 }
@@ -88,10 +166,12 @@ unset_supp_mmap_entry(struct hash *supp_page_table, void *upage)
   struct supp_entry *entry = get_supp_entry(supp_page_table, upage);
 
   ASSERT (entry != NULL);
-  ASSERT (entry->file != NULL);
+  ASSERT (entry->mmap);
   ASSERT (entry->state != IN_SWAP);
 
   acquire_frame_lock();
+  while (entry->state == EVICTING)
+    wait_frame_io();
   if (entry->state == ON_FRAME)
     {
       ASSERT (entry->kpage != NULL);
@@ -129,79 +209,321 @@ load_page(struct supp_entry *entry)
 {
   ASSERT (lock_held_by_current_thread(&frame_lock));
 
+  /* Another thread may be writing the page out right now. */
+  while (entry->state == EVICTING)
+    wait_frame_io();
+
   if (entry->state == ON_FRAME)
     return true;
 
   ASSERT (entry->kpage == NULL);
 
-  void *kpage = allocate_frame(PAL_USER, entry->upage);
-  ASSERT (kpage != NULL)
+  if (is_shared(entry))
+    return load_shared_page(entry);
 
-  if (entry->state == IN_FILE)
-  {
-    ASSERT (entry->sid == -1)
-    ASSERT (entry->file != NULL)
+  if (entry->state == IN_SWAP)
+    return load_swap_pages(entry);
 
-    fs_read_at(entry->file, kpage, entry->read_bytes, entry->offset);
-  }
+  void *kpage = allocate_frame(entry->state == ZERO_FILL
+                               ? PAL_USER | PAL_ZERO : PAL_USER,
+                               entry->upage);
+  ASSERT (kpage != NULL)
 
-  if (entry->state == IN_SWAP)
+  /* The new frame is pinned, and only this thread touches its own
+   * pages that are not on a frame, so frame_lock can be released
+   * for the read. */
+  begin_frame_io();
+  release_frame_lock();
+  if (entry->state == IN_FILE || entry->state == IN_EXEC)
   {
-    ASSERT (entry->sid != -1)
-    ASSERT (entry->file == NULL)
-
-    swap_in(entry->sid, kpage);
-    entry->sid = -1;
+    read_file_page(entry, kpage);
   }
+  acquire_frame_lock();
 
   struct thread *cur = thread_current();
+  bool success = pagedir_get_page(cur->pagedir, entry->upage) == NULL
+                 && pagedir_set_page(cur->pagedir, entry->upage, kpage,
+                                     entry->writable);
+  if (success)
+    {
+      pagedir_set_accessed(cur->pagedir, kpage, false);
+      pagedir_set_dirty(cur->pagedir, kpage, false);
 
-  if (pagedir_get_page(cur->pagedir, entry->upage) != NULL)
-    return false;
-  if (!pagedir_set_page(cur->pagedir, entry->upage, kpage, entry->writable))
-    return false;
+      entry->state = ON_FRAME;
+      entry->kpage = kpage;
 
-  pagedir_set_accessed(cur->pagedir, kpage, false);
-  pagedir_set_dirty(cur->pagedir, kpage, false);
+      unpin_frame(kpage);
+    }
+  else
+    free_frame(kpage, true);
+  end_frame_io();
 
-  entry->state = ON_FRAME;
-  entry->kpage = kpage;
+  return success;
+}
 
-  unpin_frame(kpage);
+/* Evicts the CNT pages in ENTRIES, each mapped in the page
+ * directory at the same index in PAGEDIRS, whose frames the
+ * caller has pinned. The pages that go to swap are written in one
+ * batch, so that they land in consecutive swap regions. */
+void
+evict_pages(struct supp_entry **entries, uint32_t **pagedirs, size_t cnt)
+{
+  ASSERT (lock_held_by_current_thread(&frame_lock));
+  ASSERT (cnt <= EVICT_BATCH);
 
-  return true;
+  enum page_state next[EVICT_BATCH];
+  bool dirty[EVICT_BATCH];
+  void *swap_kpages[EVICT_BATCH];
+  sid_t sids[EVICT_BATCH];
+  size_t swap_cnt = 0;
+  bool io = false;
+
+  for (size_t i = 0; i < cnt; ++i)
+    {
+      struct supp_entry *entry = entries[i];
+      uint32_t *pagedir = pagedirs[i];
+
+      ASSERT (entry->state == ON_FRAME);
+      ASSERT (entry->kpage != NULL);
+      ASSERT (!is_shared(entry));
+
+      /* Unmap the page first, so that the owner faults and waits
+       * for the eviction instead of changing the page while it is
+       * being written. Clearing a page keeps its dirty bit. */
+      pagedir_clear_page(pagedir, entry->upage);
+
+      dirty[i] = pagedir_is_dirty(pagedir, entry->upage)
+                 || pagedir_is_dirty(pagedir, entry->kpage);
+
+      /* A memory-mapped page goes back to its file. An executable
+       * page that is unchanged can simply be read again; once
+       * changed, it goes to swap like any other page. */
+      if (entry->mmap)
+        next[i] = IN_FILE;
+      else if (entry->file != NULL && !dirty[i])
+        next[i] = IN_EXEC;
+      else
+        next[i] = IN_SWAP;
+
+      if (next[i] == IN_SWAP)
+        swap_kpages[swap_cnt++] = entry->kpage;
+      if (next[i] == IN_SWAP || (next[i] == IN_FILE && dirty[i]))
+        io = true;
+      entry->state = EVICTING;
+    }
+
+  /* The caller has pinned the frames, so do the I/O without
+   * frame_lock and let faults on other pages go on. */
+  if (io)
+    {
+      release_frame_lock();
+      if (swap_cnt > 0)
+        swap_out_batch(swap_kpages, swap_cnt, sids);
+      for (size_t i = 0; i < cnt; ++i)
+        if (next[i] == IN_FILE && dirty[i])
+          fs_write_at(entries[i]->file, entries[i]->kpage,
+                      entries[i]->read_bytes, entries[i]->offset);
+      acquire_frame_lock();
+    }
+
+  for (size_t i = 0, j = 0; i < cnt; ++i)
+    {
+      struct supp_entry *entry = entries[i];
+
+      entry->sid = next[i] == IN_SWAP ? sids[j++] : -1;
+      entry->state = next[i];
+      entry->kpage = NULL;
+      if (next[i] == IN_SWAP)
+        entry->file = NULL;
+    }
 }
 
+/* Unmaps ENTRY, a page on a shared frame that is being evicted,
+ * from its process, which will read it again on its next fault. */
 void
-evict_page(struct supp_entry *entry, uint32_t *pagedir)
+unmap_shared_page(struct supp_entry *entry)
 {
   ASSERT (lock_held_by_current_thread(&frame_lock));
-
   ASSERT (entry->state == ON_FRAME);
-  ASSERT (entry->kpage != NULL);
+  ASSERT (is_shared(entry));
 
+  pagedir_clear_page(entry->pagedir, entry->upage);
+  entry->state = IN_EXEC;
+  entry->kpage = NULL;
+  entry->pagedir = NULL;
+}
 
-  bool dirty = pagedir_is_dirty(pagedir, entry->upage)
-               || pagedir_is_dirty(pagedir, entry->kpage);
+/* Returns whether ENTRY, a read-only page of the executable, is
+ * kept on a frame shared by every process running it. */
+static bool
+is_shared(const struct supp_entry *entry)
+{
+  return !entry->mmap && entry->file != NULL && !entry->writable;
+}
 
-  if (entry->file == NULL)
+/* Maps the shared frame holding ENTRY, reading the page into a
+ * new frame if no other process has it in memory. */
+static bool
+load_shared_page(struct supp_entry *entry)
+{
+  ASSERT (lock_held_by_current_thread(&frame_lock));
+  ASSERT (entry->state == IN_EXEC);
+
+  struct thread *cur = thread_current();
+  struct inode *inode = file_get_inode(entry->file);
+
+  void *kpage = find_shared_frame(inode, entry->offset);
+  bool read = false;
+  if (kpage == NULL)
     {
-      entry->sid = swap_out(entry->kpage);
-      entry->state = IN_SWAP;
+      void *new_kpage = allocate_frame(PAL_USER, entry->upage);
+      ASSERT (new_kpage != NULL)
+
+      /* allocate_frame() may have released frame_lock, and another
+       * process may have brought the page in meanwhile. */
+      kpage = find_shared_frame(inode, entry->offset);
+      if (kpage != NULL)
+        free_frame(new_kpage, true);
+      else
+        {
+          kpage = new_kpage;
+          read = true;
+        }
     }
-  else
+  if (read)
     {
-      if (dirty)
+      share_frame(kpage, inode, entry->offset);
+
+      /* Processes that fault on the same page meanwhile wait for
+       * this read instead of starting their own. */
+      begin_frame_io();
+      release_frame_lock();
+      read_file_page(entry, kpage);
+      acquire_frame_lock();
+    }
+
+  entry->state = ON_FRAME;
+  entry->kpage = kpage;
+  entry->pagedir = cur->pagedir;
+  add_frame_sharer(kpage, entry);
+  if (read)
+    end_frame_io();
+
+  if (pagedir_get_page(cur->pagedir, entry->upage) != NULL)
+    return false;
+  return pagedir_set_page(cur->pagedir, entry->upage, kpage, false);
+}
+
+/* Reads ENTRY in from swap. The pages around it in the process's
+ * address space that went to the neighboring swap regions were
+ * most likely evicted along with it, and will likely be needed
+ * soon, so up to SWAP_READ_AROUND of them are read in the same
+ * pass while frames are plentiful. */
+static bool
+load_swap_pages(struct supp_entry *entry)
+{
+  ASSERT (lock_held_by_current_thread(&frame_lock));
+  ASSERT (entry->sid != -1)
+  ASSERT (entry->file == NULL)
+
+  struct thread *cur = thread_current();
+  struct supp_entry *pages[SWAP_READ_AROUND + 1];
+  void *kpages[SWAP_READ_AROUND + 1];
+  void *kpage = allocate_frame(PAL_USER, entry->upage);
+  ASSERT (kpage != NULL)
+
+  /* Never evict a page to read around another. */
+  int first = 0, last = 0;
+  while (last - first < SWAP_READ_AROUND
+         && palloc_user_free_cnt() > pageout_low + (last - first)
+         && swap_neighbor(entry, last + 1) != NULL)
+    last++;
+  while (last - first < SWAP_READ_AROUND
+         && palloc_user_free_cnt() > pageout_low + (last - first)
+         && swap_neighbor(entry, first - 1) != NULL)
+    first--;
+
+  size_t cnt = last - first + 1;
+  for (size_t i = 0; i < cnt; ++i)
+    {
+      int delta = first + (int) i;
+      pages[i] = delta == 0 ? entry : swap_neighbor(entry, delta);
+      kpages[i] = delta == 0 ? kpage
+                             : allocate_frame(PAL_USER, pages[i]->upage);
+      ASSERT (kpages[i] != NULL)
+    }
+
+  /* As in load_page(), only this thread touches these pages. */
+  begin_frame_io();
+  release_frame_lock();
+  swap_in_batch(entry->sid + first, kpages, cnt);
+  acquire_frame_lock();
+
+  bool success = true;
+  for (size_t i = 0; i < cnt; ++i)
+    {
+      struct supp_entry *page = pages[i];
+
+      if (pagedir_get_page(cur->pagedir, page->upage) != NULL
+          || !pagedir_set_page(cur->pagedir, page->upage, kpages[i],
+                               page->writable))
         {
-          fs_write_at(entry->file, entry->kpage,
-                      entry->read_bytes, entry->offset);
+          /* Leave the page in swap, where its contents are still
+           * safe. Only the faulting page decides the result. */
+          free_frame(kpages[i], true);
+          if (page == entry)
+            success = false;
+          continue;
         }
-      entry->state = IN_FILE;
+
+      /* The page is mapped, so its swap region is not needed any
+       * more. */
+      swap_free(page->sid);
+      page->sid = -1;
+
+      /* Pages read around the faulting one count as not accessed,
+       * so that they are evicted first if they are not used. */
+      pagedir_set_accessed(cur->pagedir, page->upage, false);
+      pagedir_set_accessed(cur->pagedir, kpages[i], false);
+      pagedir_set_dirty(cur->pagedir, kpages[i], false);
+
+      page->state = ON_FRAME;
+      page->kpage = kpages[i];
+      unpin_frame(kpages[i]);
     }
+  end_frame_io();
+  return success;
+}
 
-  pagedir_clear_page(pagedir, entry->upage);
-  entry->kpage = NULL;
+/* Returns the page DELTA pages away from ENTRY in the current
+ * process, if it is in the swap region DELTA regions away from
+ * ENTRY's, or NULL. */
+static struct supp_entry*
+swap_neighbor(struct supp_entry *entry, int delta)
+{
+  struct thread *cur = thread_current();
+  struct supp_entry *page = get_supp_entry(&cur->supp_page_table,
+                                           (uint8_t *) entry->upage
+                                           + delta * PGSIZE);
+  if (page == NULL || page->state != IN_SWAP
+      || page->sid != entry->sid + delta)
+    return NULL;
+  return page;
+}
 
+/* Reads ENTRY's part of its file into KPAGE and zeros the rest. */
+static void
+read_file_page(struct supp_entry *entry, void *kpage)
+{
+  ASSERT (entry->sid == -1)
+  ASSERT (entry->file != NULL)
+
+  /* System calls load and pin the user memory they pass to the
+   * file system first, so no fault happens under fs_lock. */
+  ASSERT (!is_holding_fs_lock())
+  fs_read_at(entry->file, kpage, entry->read_bytes, entry->offset);
+  memset((uint8_t *) kpage + entry->read_bytes, 0,
+         PGSIZE - entry->read_bytes);
 }
 
 static unsigned
@@ -227,19 +549,30 @@ supp_destroy_func (struct hash_elem *e, void *aux)
   struct supp_entry *entry = hash_entry(e, struct supp_entry, elem);
 
   ASSERT (entry != NULL);
+
+  while (entry->state == EVICTING)
+    wait_frame_io();
+
   ASSERT (entry->state != IN_FILE);
-  ASSERT (entry->file == NULL);
+  ASSERT (!entry->mmap);
 
-  if (entry->state == ON_FRAME)
+  if (entry->state == ON_FRAME && is_shared(entry))
+    {
+      /* Keep pagedir_destroy() from freeing a frame that other
+       * processes may still map. */
+      pagedir_clear_page(entry->pagedir, entry->upage);
+      remove_frame_sharer(entry->kpage, entry);
+    }
+  else if (entry->state == ON_FRAME)
     {
       ASSERT (entry->kpage != NULL);
       free_frame(entry->kpage, false);
     }
-  else
+  else if (entry->state == IN_SWAP)
     {
       ASSERT (entry->sid != -1);
       swap_free(entry->sid);
     }
 
-  free(entry);
+  kmem_cache_free(supp_cache, entry);
 }
@@ -3,13 +3,23 @@
 
 #include <filesys/off_t.h>
 #include <lib/kernel/hash.h>
+#include <lib/kernel/list.h>
 #include "vm/swap.h"
 
+/* Most pages evict_pages() writes out at once. */
+#define EVICT_BATCH 8
+
+/* Most pages read from swap along with a faulting page. */
+#define SWAP_READ_AROUND 7
+
 enum page_state
   {
     ON_FRAME,
     IN_SWAP,
-    IN_FILE
+    IN_FILE,
+    IN_EXEC,                      /* Not yet read from the executable. */
+    ZERO_FILL,                    /* Not yet touched, all zeros. */
+    EVICTING                      /* Being written out of its frame. */
   };
 
 struct supp_entry
@@ -25,12 +35,21 @@ struct supp_entry
 
     sid_t sid;                    /* Only valid when state == IN_SWAP. */
 
+    /* Backing file: a memory-mapped file if 'mmap', otherwise the
+     * executable, until the page is changed and goes to swap. */
     struct file * file;
     uint32_t offset;
     uint32_t read_bytes;
+    bool mmap;
 
+    /* A read-only executable page on a frame is shared with other
+     * processes running the same executable. */
+    uint32_t *pagedir;            /* Owner's page directory. */
+    struct list_elem share_elem;  /* In the shared frame's sharers. */
   };
 
+void page_init(void);
+
 void supp_page_table_init(struct hash *supp_page_table);
 
 void supp_page_table_destroy(struct hash *supp_page_table);
@@ -43,10 +62,20 @@ bool set_supp_mmap_entry(struct hash *supp_page_table, void *upage,
 
 void unset_supp_mmap_entry(struct hash *supp_page_table, void *upage);
 
+bool set_supp_exec_entry(struct hash *supp_page_table, void *upage,
+                         struct file *file, uint32_t offset,
+                         uint32_t read_bytes, bool writable);
+
+bool set_supp_zero_entry(struct hash *supp_page_table, void *upage,
+                         bool writable);
+
 struct supp_entry* get_supp_entry(struct hash *supp_page_table, void *upage);
 
 bool load_page(struct supp_entry *entry);
 
-void evict_page(struct supp_entry *entry, uint32_t *pagedir);
+void evict_pages(struct supp_entry **entries, uint32_t **pagedirs,
+                 size_t cnt);
+
+void unmap_shared_page(struct supp_entry *entry);
 
 #endif //VM_PAGE_H
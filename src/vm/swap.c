@@ -15,6 +15,23 @@ static struct bitmap *swap_map;
 
 static size_t swap_size;
 
+/* Swap regions are handed out from a cursor that moves forward
+ * through the swap map, so that pages evicted one after another
+ * land in consecutive regions and can be read back together. */
+static size_t swap_cursor;
+
+/* Statistics. */
+static long long out_cnt;         /* Pages written. */
+static long long batch_cnt;       /* Calls to swap_out_batch(). */
+static long long in_cnt;          /* Pages read. */
+static long long read_around_cnt; /* Pages read along with another. */
+
+static size_t alloc_regions(size_t cnt);
+
+static void write_region(size_t sid, const void *kpage);
+
+static void read_region(size_t sid, void *kpage);
+
 void
 swap_init()
 {
@@ -28,34 +45,41 @@ swap_init()
   bitmap_set_all(swap_map, true);
 }
 
-sid_t
-swap_out(void *upage)
+void
+swap_out_batch(void **kpages, size_t cnt, sid_t *sids)
 {
   lock_acquire(&swap_lock);
-  sid_t sid = (sid_t) bitmap_scan_and_flip(swap_map, 0, 1, true);
-  if (sid == BITMAP_ERROR)
-    PANIC ("Swap block is full");
-
-  for (size_t i = 0; i < SECTORS_PER_PAGE; ++i)
+  size_t first = alloc_regions(cnt);
+  for (size_t i = 0; i < cnt; ++i)
     {
-      block_write(swap_block, (block_sector_t) (sid * SECTORS_PER_PAGE + i),
-                  ((char *) upage) + i * BLOCK_SECTOR_SIZE);
+      size_t sid = first != BITMAP_ERROR ? first + i : alloc_regions(1);
+      if (sid == BITMAP_ERROR)
+        PANIC ("Swap block is full");
+      sids[i] = (sid_t) sid;
     }
-
+  out_cnt += cnt;
+  batch_cnt++;
   lock_release(&swap_lock);
-  return sid;
+
+  /* The regions are ours now, so write them without swap_lock. */
+  for (size_t i = 0; i < cnt; ++i)
+    write_region((size_t) sids[i], kpages[i]);
 }
 
-void swap_in(sid_t sid, void *upage)
+void
+swap_in_batch(sid_t sid, void **kpages, size_t cnt)
 {
+  ASSERT (sid >= 0 && (size_t) sid + cnt <= swap_size);
+
+  /* The regions stay ours until freed, so read them without
+   * swap_lock. */
+  for (size_t i = 0; i < cnt; ++i)
+    read_region((size_t) sid + i, kpages[i]);
+
   lock_acquire(&swap_lock);
-  ASSERT (sid < swap_size && !bitmap_test(swap_map, (size_t) sid));
-  for (size_t i = 0; i < SECTORS_PER_PAGE; ++i)
-    {
-      block_read(swap_block, (block_sector_t) (sid * SECTORS_PER_PAGE + i),
-                 ((char *) upage) + i * BLOCK_SECTOR_SIZE);
-    }
-  bitmap_set(swap_map, (size_t) sid, true);
+  ASSERT (!bitmap_contains(swap_map, (size_t) sid, cnt, true));
+  in_cnt += cnt;
+  read_around_cnt += cnt - 1;
   lock_release(&swap_lock);
 }
 
@@ -65,4 +89,48 @@ void swap_free(sid_t sid)
   ASSERT (sid < swap_size && !bitmap_test(swap_map, (size_t) sid));
   bitmap_set(swap_map, (size_t) sid, true);
   lock_release(&swap_lock);
-}
\ No newline at end of file
+}
+
+void
+swap_print_stats()
+{
+  printf("Swap: %lld pages out in %lld batches, "
+         "%lld pages in (%lld read around)\n",
+         out_cnt, batch_cnt, in_cnt, read_around_cnt);
+}
+
+/* Allocates CNT consecutive swap regions at or after the cursor,
+ * or anywhere if there are none, and returns the first, or
+ * BITMAP_ERROR if there is no such run. */
+static size_t
+alloc_regions(size_t cnt)
+{
+  ASSERT (lock_held_by_current_thread(&swap_lock));
+
+  size_t sid = bitmap_scan_and_flip_near(swap_map, swap_cursor, cnt, true);
+  if (sid != BITMAP_ERROR)
+    swap_cursor = sid + cnt < swap_size ? sid + cnt : 0;
+  return sid;
+}
+
+/* The block layer moves one sector at a time, so a region takes
+ * SECTORS_PER_PAGE transfers to consecutive sectors. */
+static void
+write_region(size_t sid, const void *kpage)
+{
+  for (size_t i = 0; i < SECTORS_PER_PAGE; ++i)
+    {
+      block_write(swap_block, (block_sector_t) (sid * SECTORS_PER_PAGE + i),
+                  ((const char *) kpage) + i * BLOCK_SECTOR_SIZE);
+    }
+}
+
+static void
+read_region(size_t sid, void *kpage)
+{
+  for (size_t i = 0; i < SECTORS_PER_PAGE; ++i)
+    {
+      block_read(swap_block, (block_sector_t) (sid * SECTORS_PER_PAGE + i),
+                 ((char *) kpage) + i * BLOCK_SECTOR_SIZE);
+    }
+}
@@ -1,6 +1,8 @@
 #ifndef VM_SWAP_H
 #define VM_SWAP_H
 
+#include <stddef.h>
+
 typedef int32_t sid_t;
 
 struct lock swap_lock;
@@ -8,17 +10,20 @@ struct lock swap_lock;
 /* Initialize the swap table. */
 void swap_init();
 
-/* Move the content of the user virtual page to the swap disk
- * and return the index of the swap region where the content
- * is placed. */
-sid_t swap_out(void *upage);
-
+/* Move the content of the 'cnt' pages in 'kpages' to the swap
+ * disk, in consecutive regions if possible, and store their
+ * indexes in 'sids'. */
+void swap_out_batch(void **kpages, size_t cnt, sid_t *sids);
 
-/* Move the content of the 'sid'-th swap region to the user
- * virtual page. */
-void swap_in(sid_t sid, void *upage);
+/* Copy the content of the 'cnt' swap regions starting at the
+ * 'sid'-th to the pages in 'kpages'. The regions stay occupied
+ * until freed with swap_free(). */
+void swap_in_batch(sid_t sid, void **kpages, size_t cnt);
 
 /* Free the 'sid'-th swap region. */
 void swap_free(sid_t sid);
 
+/* Print swap statistics. */
+void swap_print_stats(void);
+
 #endif //VM_SWAP_H